@@ -0,0 +1,153 @@
+/**
+ * animation_player.cc
+ *
+ * Created by vamirio on 2022 Sep 24
+ */
+#include "animation_player.h"
+
+#include "debug.h"
+
+namespace img_view {
+
+AnimationPlayer::AnimationPlayer(QObject* parent) : QObject(parent)
+{
+	_timer.setSingleShot(true);
+	connect(&_timer, &QTimer::timeout, this, &AnimationPlayer::showNextFrame);
+}
+
+AnimationPlayer::~AnimationPlayer()
+{
+	stop();
+}
+
+bool AnimationPlayer::open(const ImageInfo& info)
+{
+	stop();
+	_reader = createFrameReader(info);
+	if (!_reader) {
+		gWarn() << "Failed to play" << info.filename();
+		return false;
+	}
+
+	_path = info.absPath();
+	_thread = QThread::create([this]() { run(); });
+	_thread->start();
+	_timer.start(0);
+	return true;
+}
+
+void AnimationPlayer::stop()
+{
+	_timer.stop();
+	if (_thread) {
+		QMutexLocker locker(&_mutex);
+		_stopped = true;
+		_notFull.wakeAll();
+		locker.unlock();
+		_thread->wait();
+		delete _thread;
+		_thread = nullptr;
+	}
+	_reader.reset();
+
+	_ring.clear();
+	_delays.clear();
+	_stopped = false;
+	_finished = false;
+	_current = Frame();
+	_path.clear();
+}
+
+const QString& AnimationPlayer::fileName() const
+{
+	return _path;
+}
+
+void AnimationPlayer::setScaledSize(const QSize& size)
+{
+	QMutexLocker locker(&_mutex);
+	if (size == _scaledSize)
+		return;
+	_scaledSize = size;
+	locker.unlock();
+
+	/* Keep the current frame, the ones in the ring are scaled when shown. */
+	if (!_current.source.isNull()) {
+		_current.scaled = scaled(_current.source, size);
+		emit frameChanged(_current.scaled);
+	}
+}
+
+const QImage& AnimationPlayer::currentFrame() const
+{
+	return _current.scaled;
+}
+
+void AnimationPlayer::showNextFrame()
+{
+	QMutexLocker locker(&_mutex);
+	if (_ring.isEmpty()) {
+		bool finished = _finished;
+		locker.unlock();
+		if (!finished)
+			_timer.start(kPollInterval);
+		return;
+	}
+	Frame frame = _ring.dequeue();
+	QSize size = _scaledSize;
+	_notFull.wakeOne();
+	locker.unlock();
+
+	/* The size changed after the frame was scaled. */
+	QSize aimed = size.isValid() ? size : frame.source.size();
+	if (frame.scaled.size() != aimed)
+		frame.scaled = scaled(frame.source, size);
+	_current = frame;
+	_timer.start(frame.delay);
+	emit frameChanged(_current.scaled);
+}
+
+void AnimationPlayer::run()
+{
+	int loopCount = _reader->loopCount();
+	for (int loop = 0; ; ++loop) {
+		int index = 0;
+		Frame frame;
+		int delay = 0;
+		while (_reader->read(&frame.source, &delay)) {
+			QMutexLocker locker(&_mutex);
+			if (index == _delays.size())
+				_delays.append(delay > 10 ? delay : kDefaultDelay);
+			frame.delay = _delays[index++];
+			QSize size = _scaledSize;
+			locker.unlock();
+
+			frame.scaled = scaled(frame.source, size);
+
+			locker.relock();
+			while (!_stopped && _ring.size() >= kRingSize)
+				_notFull.wait(&_mutex);
+			if (_stopped)
+				return;
+			_ring.enqueue(frame);
+		}
+
+		/* A loop count of -1 means looping forever. */
+		if (index <= 1 || (loopCount >= 0 && loop >= loopCount)
+				|| !_reader->rewind())
+			break;
+	}
+
+	QMutexLocker locker(&_mutex);
+	_finished = true;
+}
+
+QImage AnimationPlayer::scaled(const QImage& image, const QSize& size)
+{
+	if (!size.isValid() || size == image.size())
+		return image;
+	return image.scaled(size, Qt::IgnoreAspectRatio,
+			Qt::SmoothTransformation);
+}
+
+}  /* img_view */
@@ -0,0 +1,130 @@
+/**
+ * animation_player.h
+ *
+ * Play animated images (GIF, WebP and APNG) with bounded memory, the frames
+ * are decoded and scaled by a worker thread a few frames ahead of the shown
+ * one.
+ *
+ * Created by vamirio on 2022 Sep 24
+ */
+#ifndef ANIMATION_PLAYER_H
+#define ANIMATION_PLAYER_H
+
+#include <memory>
+
+#include <QObject>
+#include <QImage>
+#include <QMutex>
+#include <QQueue>
+#include <QSize>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "frame_reader.h"
+#include "image_info.h"
+
+namespace img_view {
+
+class AnimationPlayer : public QObject {
+	Q_OBJECT
+
+public:
+	explicit AnimationPlayer(QObject* parent = nullptr);
+	~AnimationPlayer();
+
+	AnimationPlayer(const AnimationPlayer&) = delete;
+	AnimationPlayer& operator=(const AnimationPlayer&) = delete;
+
+	/**
+	 * @brief Stop the current animation, then play the image INFO.
+	 *
+	 * @return False if the image can't be read.
+	 */
+	bool open(const ImageInfo& info);
+
+	/**
+	 * @brief Stop playing and release the frames.
+	 */
+	void stop();
+
+	/**
+	 * @brief Get the path of the animation, it is empty when stopped.
+	 */
+	const QString& fileName() const;
+
+	/**
+	 * @brief Set the size the frames are scaled to, the current frame is
+	 *        scaled again and shown immediately, the animation goes on from
+	 *        it.
+	 *
+	 * @param size The scaled size, an invalid size for the original size
+	 */
+	void setScaledSize(const QSize& size);
+
+	/**
+	 * @brief Get the current frame after scaled.
+	 */
+	const QImage& currentFrame() const;
+
+signals:
+	/**
+	 * @brief Emitted when FRAME is to be shown.
+	 */
+	void frameChanged(const QImage& frame);
+
+private slots:
+	/**
+	 * @brief Show the next decoded frame and wait for its delay.
+	 */
+	void showNextFrame();
+
+private:
+	struct Frame {
+		QImage source;
+		QImage scaled;
+		int delay = 0;
+	};
+
+	/**
+	 * @brief Decode and scale the frames into the ring, run in the worker
+	 *        thread.
+	 */
+	void run();
+
+	/**
+	 * @brief Scale IMAGE to SIZE, IMAGE is returned when no scaling needed.
+	 */
+	static QImage scaled(const QImage& image, const QSize& size);
+
+private:
+	QString _path;
+	/* Used by the worker only while it is running. */
+	std::unique_ptr<FrameReader> _reader;
+	QThread* _thread = nullptr;
+	QTimer _timer;
+	Frame _current;
+
+	/* Protect the members below, which are shared with the worker. */
+	QMutex _mutex;
+	QWaitCondition _notFull;
+	QQueue<Frame> _ring;
+	QSize _scaledSize;
+	/* Delays of the frames, they are read in the first loop. */
+	QVector<int> _delays;
+	bool _stopped = false;
+	bool _finished = false;
+
+	/* Max number of frames decoded ahead. */
+	static constexpr int kRingSize = 4;
+	/* Delay of the frames without a proper one, the same as the browsers. */
+	static constexpr int kDefaultDelay = 100;
+	/* Time to wait when the worker falls behind. */
+	static constexpr int kPollInterval = 5;
+};
+
+}  /* img_view */
+
+#endif /* ifndef ANIMATION_PLAYER_H */
@@ -0,0 +1,470 @@
+/**
+ * batch_io.cc
+ *
+ * Created by vamirio on 2022 Nov 05
+ */
+#include "batch_io.h"
+
+#include <algorithm>
+#include <functional>
+
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QThreadPool>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <cerrno>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define BATCH_IO_URING
+#endif
+
+#include "debug.h"
+
+namespace img_view {
+
+#ifdef BATCH_IO_URING
+
+/* Max number of requests in flight. */
+static constexpr unsigned kRingSize = 64;
+
+/*
+ * A minimal io_uring owned by one thread, the requests are submitted in
+ * batches and waited for together.
+ */
+class Ring {
+public:
+	Ring();
+	~Ring();
+
+	Ring(const Ring&) = delete;
+	Ring& operator=(const Ring&) = delete;
+
+	/**
+	 * @brief Get the ring of the calling thread.
+	 *
+	 * @return The ring, or nullptr when io_uring is unavailable
+	 */
+	static Ring* local();
+
+	/**
+	 * @brief Run COUNT requests and wait for all of them.
+	 *
+	 * @param prepare Fill the submission of the request I
+	 * @param complete Take the result of the request I, a negated errno when
+	 *        it failed
+	 *
+	 * @return False when the ring failed, it is torn down and local()
+	 *         returns nullptr for the thread afterwards
+	 */
+	bool run(std::size_t count,
+			const std::function<void(std::size_t i, io_uring_sqe* sqe)>& prepare,
+			const std::function<void(std::size_t i, int res)>& complete);
+
+private:
+	/**
+	 * @brief Check if the kernel supports all the operations we use.
+	 */
+	bool probe() const;
+
+	void destroy();
+
+private:
+	int _fd = -1;
+	unsigned _entries = 0;
+
+	void* _sq = MAP_FAILED;
+	std::size_t _sqSize = 0;
+	void* _cq = MAP_FAILED;
+	std::size_t _cqSize = 0;
+	io_uring_sqe* _sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	std::size_t _sqesSize = 0;
+
+	unsigned* _sqHead = nullptr;
+	unsigned* _sqTail = nullptr;
+	unsigned* _sqMask = nullptr;
+	unsigned* _sqArray = nullptr;
+	unsigned* _cqHead = nullptr;
+	unsigned* _cqTail = nullptr;
+	unsigned* _cqMask = nullptr;
+	io_uring_cqe* _cqes = nullptr;
+};
+
+Ring::Ring()
+{
+	io_uring_params params = {};
+	_fd = static_cast<int>(syscall(__NR_io_uring_setup, kRingSize, &params));
+	if (_fd < 0) {
+		gDebug() << "io_uring is unavailable, errno:" << errno;
+		return;
+	}
+	_entries = params.sq_entries;
+
+	/* Newer kernels map both rings at once. */
+	_sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single)
+		_sqSize = _cqSize = std::max(_sqSize, _cqSize);
+	_sq = mmap(nullptr, _sqSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	if (_sq != MAP_FAILED && !single) {
+		_cq = mmap(nullptr, _cqSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+	}
+	_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	_sqes = static_cast<io_uring_sqe*>(mmap(nullptr, _sqesSize,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd,
+				IORING_OFF_SQES));
+	void* cq = single ? _sq : _cq;
+	if (_sq == MAP_FAILED || cq == MAP_FAILED || _sqes == MAP_FAILED) {
+		gWarn() << "Failed to map io_uring, errno:" << errno;
+		destroy();
+		return;
+	}
+
+	char* sq = static_cast<char*>(_sq);
+	_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	char* cqp = static_cast<char*>(cq);
+	_cqHead = reinterpret_cast<unsigned*>(cqp + params.cq_off.head);
+	_cqTail = reinterpret_cast<unsigned*>(cqp + params.cq_off.tail);
+	_cqMask = reinterpret_cast<unsigned*>(cqp + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cqp + params.cq_off.cqes);
+
+	if (!probe()) {
+		gDebug() << "io_uring lacks the needed operations.";
+		destroy();
+	}
+}
+
+Ring::~Ring()
+{
+	destroy();
+}
+
+Ring* Ring::local()
+{
+	thread_local Ring ring;
+	return ring._fd < 0 ? nullptr : &ring;
+}
+
+bool Ring::run(std::size_t count,
+		const std::function<void(std::size_t i, io_uring_sqe* sqe)>& prepare,
+		const std::function<void(std::size_t i, int res)>& complete)
+{
+	std::size_t prepared = 0;
+	std::size_t completed = 0;
+	while (completed != count) {
+		/* Keep at most _entries requests in flight, so neither the
+		 * submission queue nor the completion queue overflows. */
+		unsigned tail = *_sqTail;
+		for (; prepared != count && prepared - completed < _entries;
+				++prepared, ++tail) {
+			unsigned index = tail & *_sqMask;
+			io_uring_sqe* sqe = &_sqes[index];
+			*sqe = io_uring_sqe();
+			prepare(prepared, sqe);
+			sqe->user_data = prepared;
+			_sqArray[index] = index;
+		}
+		__atomic_store_n(_sqTail, tail, __ATOMIC_RELEASE);
+
+		unsigned pending = tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+		long ret = syscall(__NR_io_uring_enter, _fd, pending, 1,
+				IORING_ENTER_GETEVENTS, nullptr, 0);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			/* The requests in flight refer to the buffers of the caller, the
+			 * ring can't be reused, tear it down so they are cancelled and
+			 * no stale completions are reaped later. */
+			gWarn() << "io_uring_enter failed, errno:" << errno;
+			destroy();
+			return false;
+		}
+
+		unsigned head = *_cqHead;
+		unsigned cqTail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+		for (; head != cqTail; ++head, ++completed) {
+			const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+			complete(static_cast<std::size_t>(cqe.user_data), cqe.res);
+		}
+		__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+bool Ring::probe() const
+{
+	constexpr unsigned kOps = 256;
+	std::vector<char> buf(sizeof(io_uring_probe)
+			+ kOps * sizeof(io_uring_probe_op));
+	io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+	if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PROBE, probe,
+				kOps) < 0)
+		return false;
+
+	for (int op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+			IORING_OP_FADVISE }) {
+		if (op > probe->last_op
+				|| !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+			return false;
+	}
+	return true;
+}
+
+void Ring::destroy()
+{
+	if (_sqes != MAP_FAILED)
+		munmap(_sqes, _sqesSize);
+	if (_cq != MAP_FAILED)
+		munmap(_cq, _cqSize);
+	if (_sq != MAP_FAILED)
+		munmap(_sq, _sqSize);
+	_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+	_cq = _sq = MAP_FAILED;
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+}
+
+/**
+ * @brief Open the files PATHS for reading.
+ *
+ * @param fds The file descriptors, negative for the files failed to open
+ *
+ * @return False when the ring failed, nothing is left opened then
+ */
+static bool openFiles(Ring* ring, const std::vector<QByteArray>& paths,
+		std::vector<int>* fds)
+{
+	fds->assign(paths.size(), -1);
+	bool ok = ring->run(paths.size(),
+			[&paths](std::size_t i, io_uring_sqe* sqe) {
+				sqe->opcode = IORING_OP_OPENAT;
+				sqe->fd = AT_FDCWD;
+				sqe->addr = reinterpret_cast<quint64>(paths[i].constData());
+				sqe->open_flags = O_RDONLY | O_CLOEXEC;
+			},
+			[fds](std::size_t i, int res) { (*fds)[i] = res; });
+	if (!ok) {
+		for (int& fd : *fds) {
+			if (fd >= 0)
+				close(fd);
+			fd = -1;
+		}
+	}
+	return ok;
+}
+
+static void closeFiles(const std::vector<int>& fds)
+{
+	for (int fd : fds) {
+		if (fd >= 0)
+			close(fd);
+	}
+}
+
+/**
+ * @brief Encode PATHS to the local 8-bit paths of the system.
+ */
+static std::vector<QByteArray> encodePaths(const QStringList& paths)
+{
+	std::vector<QByteArray> ret;
+	ret.reserve(paths.size());
+	for (const QString& path : paths)
+		ret.push_back(QFile::encodeName(path));
+	return ret;
+}
+
+/**
+ * @brief Get the status of the files NAMES relative to the directory DIRFD.
+ */
+static bool uringStat(int dirfd, const std::vector<QByteArray>& names,
+		std::vector<FileStat>* stats)
+{
+	Ring* ring = Ring::local();
+	if (!ring)
+		return false;
+
+	std::vector<struct statx> bufs(names.size());
+	return ring->run(names.size(),
+			[dirfd, &names, &bufs](std::size_t i, io_uring_sqe* sqe) {
+				sqe->opcode = IORING_OP_STATX;
+				sqe->fd = dirfd;
+				sqe->addr = reinterpret_cast<quint64>(names[i].constData());
+				sqe->len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+				sqe->off = reinterpret_cast<quint64>(&bufs[i]);
+			},
+			[&bufs, stats](std::size_t i, int res) {
+				if (res < 0)
+					return;
+				const struct statx& buf = bufs[i];
+				(*stats)[i].size = static_cast<qint64>(buf.stx_size);
+				(*stats)[i].lastModified = buf.stx_mtime.tv_sec * 1000LL
+					+ buf.stx_mtime.tv_nsec / 1000000;
+				(*stats)[i].regular = S_ISREG(buf.stx_mode);
+			});
+}
+
+static bool uringReadHeads(const QStringList& paths, qint64 len,
+		std::vector<QByteArray>* heads)
+{
+	Ring* ring = Ring::local();
+	if (!ring)
+		return false;
+
+	std::vector<int> fds;
+	if (!openFiles(ring, encodePaths(paths), &fds))
+		return false;
+	std::vector<std::size_t> opened;
+	for (std::size_t i = 0; i != fds.size(); ++i) {
+		if (fds[i] >= 0) {
+			opened.push_back(i);
+			(*heads)[i] = QByteArray(len, Qt::Uninitialized);
+		}
+	}
+
+	bool ok = ring->run(opened.size(),
+			[&opened, &fds, heads, len](std::size_t k, io_uring_sqe* sqe) {
+				std::size_t i = opened[k];
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = fds[i];
+				sqe->addr = reinterpret_cast<quint64>((*heads)[i].data());
+				sqe->len = static_cast<quint32>(len);
+				sqe->off = 0;
+			},
+			[&opened, heads](std::size_t k, int res) {
+				QByteArray& head = (*heads)[opened[k]];
+				if (res < 0)
+					head = QByteArray();
+				else
+					head.truncate(res);
+			});
+	closeFiles(fds);
+	return ok;
+}
+
+static bool uringAdviseWillNeed(const QStringList& paths)
+{
+	Ring* ring = Ring::local();
+	if (!ring)
+		return false;
+
+	std::vector<int> fds;
+	if (!openFiles(ring, encodePaths(paths), &fds))
+		return false;
+	bool ok = ring->run(fds.size(),
+			[&fds](std::size_t i, io_uring_sqe* sqe) {
+				/* A no-op for the files failed to open. */
+				if (fds[i] < 0) {
+					sqe->opcode = IORING_OP_NOP;
+					return;
+				}
+				sqe->opcode = IORING_OP_FADVISE;
+				sqe->fd = fds[i];
+				sqe->off = 0;
+				sqe->len = 0;  /* To the end of the file. */
+				sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+			},
+			[](std::size_t, int) {});
+	closeFiles(fds);
+	return ok;
+}
+
+#endif /* BATCH_IO_URING */
+
+std::vector<FileStat> statFiles(const QStringList& paths)
+{
+	std::vector<FileStat> stats(paths.size());
+#ifdef BATCH_IO_URING
+	if (uringStat(AT_FDCWD, encodePaths(paths), &stats))
+		return stats;
+	stats.assign(paths.size(), FileStat());
+#endif
+
+	for (qsizetype i = 0; i != paths.size(); ++i) {
+		QFileInfo info(paths.at(i));
+		if (!info.exists())
+			continue;
+		stats[i].size = info.size();
+		stats[i].lastModified = info.lastModified().toMSecsSinceEpoch();
+		stats[i].regular = info.isFile();
+	}
+	return stats;
+}
+
+#if defined(__unix__)
+std::vector<FileStat> statFilesAt(int dirfd,
+		const std::vector<QByteArray>& names)
+{
+	std::vector<FileStat> stats(names.size());
+#ifdef BATCH_IO_URING
+	if (uringStat(dirfd, names, &stats))
+		return stats;
+	stats.assign(names.size(), FileStat());
+#endif
+
+	for (std::size_t i = 0; i != names.size(); ++i) {
+		struct stat buf;
+		if (fstatat(dirfd, names[i].constData(), &buf, 0) != 0)
+			continue;
+		stats[i].size = buf.st_size;
+		stats[i].lastModified = buf.st_mtim.tv_sec * 1000LL
+			+ buf.st_mtim.tv_nsec / 1000000;
+		stats[i].regular = S_ISREG(buf.st_mode);
+	}
+	return stats;
+}
+#endif
+
+std::vector<QByteArray> readFileHeads(const QStringList& paths, qint64 len)
+{
+	std::vector<QByteArray> heads(paths.size());
+#ifdef BATCH_IO_URING
+	if (uringReadHeads(paths, len, &heads))
+		return heads;
+	heads.assign(paths.size(), QByteArray());
+#endif
+
+	for (qsizetype i = 0; i != paths.size(); ++i) {
+		QFile file(paths.at(i));
+		if (file.open(QIODevice::ReadOnly))
+			heads[i] = file.read(len);
+	}
+	return heads;
+}
+
+void adviseWillNeed(const QStringList& paths)
+{
+	if (paths.isEmpty())
+		return;
+
+	QThreadPool::globalInstance()->start([paths]() {
+#ifdef BATCH_IO_URING
+				if (uringAdviseWillNeed(paths))
+					return;
+#endif
+#if defined(__unix__)
+				for (const QString& path : paths) {
+					int fd = open(QFile::encodeName(path).constData(),
+							O_RDONLY | O_CLOEXEC);
+					if (fd < 0)
+						continue;
+					posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+					close(fd);
+				}
+#endif
+			});
+}
+
+}  /* img_view */
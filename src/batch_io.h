@@ -0,0 +1,66 @@
+/**
+ * batch_io.h
+ *
+ * Check and read many files in batches, so a high latency file system (NFS,
+ * SMB) takes a few round trips instead of some for every file. The requests
+ * are submitted together through io_uring on Linux, other systems and the
+ * kernels without io_uring do them one by one in the calling thread.
+ *
+ * Created by vamirio on 2022 Nov 05
+ */
+#ifndef BATCH_IO_H
+#define BATCH_IO_H
+
+#include <vector>
+
+#include <QByteArray>
+#include <QStringList>
+
+namespace img_view {
+
+/* The status of a file. */
+struct FileStat {
+	qint64 size = -1;         /* Size in bytes, -1 when failed. */
+	qint64 lastModified = 0;  /* Milliseconds since the epoch. */
+	bool regular = false;     /* Is a regular file. */
+};
+
+/**
+ * @brief Get the status of the files PATHS in a batch.
+ *
+ * @return The status of every file in the order of PATHS
+ */
+std::vector<FileStat> statFiles(const QStringList& paths);
+
+#if defined(__unix__)
+/**
+ * @brief Get the status of the files NAMES in the opened directory DIRFD in
+ *        a batch, the names are looked up in the directory directly instead
+ *        of walking the whole paths.
+ *
+ * @param names The file names in the local 8-bit encoding
+ *
+ * @return The status of every file in the order of NAMES
+ */
+std::vector<FileStat> statFilesAt(int dirfd,
+		const std::vector<QByteArray>& names);
+#endif
+
+/**
+ * @brief Read the first LEN bytes of the files PATHS in a batch.
+ *
+ * @return The data of every file in the order of PATHS, it is shorter than
+ *         LEN at the end of the file and null when failed
+ */
+std::vector<QByteArray> readFileHeads(const QStringList& paths, qint64 len);
+
+/**
+ * @brief Tell the system the files PATHS will be read soon, so they are read
+ *        ahead into the page cache. It returns immediately, the advice is
+ *        given in background.
+ */
+void adviseWillNeed(const QStringList& paths);
+
+}  /* img_view */
+
+#endif /* ifndef BATCH_IO_H */
@@ -6,48 +6,123 @@
 #include "book.h"
 
 #include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
-#include <QDir>
-#include <QFileInfo>
+#include <QHash>
+#include <QThread>
 
+#include "batch_io.h"
 #include "debug.h"
+#include "dir_scanner.h"
 
 namespace img_view {
 
-Book::Book()
+/* Probing pages is I/O bound, use more threads than cores to keep enough
+ * requests in flight on a high latency file system. */
+static constexpr int kMinScanThreadCount = 16;
+
+/* Number of files browsed by a worker at a time, also the granularity of
+ * adding pages to the page list. */
+static constexpr int kScanBatchSize = 32;
+
+/**
+ * @brief Check if the page LHS goes before RHS in the order SORT.
+ */
+static bool pageLessThan(Sort sort, const ImageInfo& lhs, const ImageInfo& rhs)
+{
+	switch (sort) {
+	case Sort::NameAscending:
+		return lhs.filename() < rhs.filename();
+	case Sort::NameDescending:
+		return lhs.filename() > rhs.filename();
+	case Sort::DateAscending:
+		return lhs.lastModified() < rhs.lastModified();
+	case Sort::DateDescending:
+		return lhs.lastModified() > rhs.lastModified();
+	case Sort::SizeAscending:
+		return lhs.size() < rhs.size();
+	case Sort::SizeDescending:
+		return lhs.size() > rhs.size();
+	default:
+		return false;
+	}
+}
+
+Book::Book(QObject* parent) : QObject(parent)
 {
+	_scanPool.setMaxThreadCount(std::max(QThread::idealThreadCount(),
+				kMinScanThreadCount));
+	connect(&_watcher, &BookWatcher::filesChanged, this, &Book::refresh);
 }
 
 Book::~Book()
 {
+	cancelScan();
 }
 
-bool Book::open(const QString& book)
+bool Book::open(const QString& book, const QString& page)
 {
 	gDebug() << "Opening book...";
-	/* Set _info. */
-	if (!_info.browse(book))
+	/* Set _info, the files of the directory are listed at the same time. */
+	std::vector<DirEntry> files;
+	if (!_info.browse(book, &files))
 		return false;
+	/* Pages of archives can't change without the whole archive changing. */
+	if (!_info.isArchive())
+		_watcher.watch(_info.absPath());
 
-	QDir dir(book);
-	QStringList filelist = dir.entryList(QDir::Files | QDir::Readable,
-			QDir::Name);
-	QString filepath;
-	for (const QString& filename : filelist) {
-		filepath = dir.filePath(filename);
-		ImageInfo info;
-		if (!info.browse(filepath))
-			continue;
-		_pageList.emplace_back(info);
+	QStringList filelist;
+	std::vector<FileStat> stats;
+	if (_info.isArchive()) {
+		/* The pages of archives are not indexed, their headers are read out
+		 * of the mapped archive. */
+		_archive = ZipArchive::open(_info.absPath());
+		if (!_archive)
+			return false;
+		for (const QString& name : _archive->names())
+			filelist.append(_archive->path() + '/' + name);
+		stats.resize(filelist.size());
+	} else {
+		_index.load(_info.absPath());
+		for (DirEntry& file : files) {
+			filelist.append(std::move(file.path));
+			stats.push_back(file.stat);
+		}
+	}
+
+	/* Browse the requested page first, so it can be shown before the whole
+	 * book is browsed. */
+	ImageInfo info;
+	int first = filelist.indexOf(page);
+	if (first == -1 || !browsePage(filelist.at(first), stats[first], &info)) {
+		for (first = 0; first != filelist.size(); ++first) {
+			if (browsePage(filelist.at(first), stats[first], &info))
+				break;
+		}
+	}
+	if (first == filelist.size()) {
+		gDebug() << "Finished opening, no pages found.";
+		emit scanFinished();
+		return true;
 	}
+
+	_pageList.emplace_back(std::move(info));
 	_pageNum = 0;
-	gDebug() << "Finished opening.";
+	scan(filelist, stats, first);
+	gDebug() << "Opened at page" << _pageList.at(_pageNum).filename();
 
 	return true;
 }
 
 void Book::close()
 {
+	_watcher.stop();
+	_refreshPending = false;
+	cancelScan();
+	_index.clear();
+	_archive.reset();
 	_info = BookInfo();
 	_pageList.clear();
 	_pageNum = -1;
@@ -58,6 +133,11 @@ bool Book::empty() const
 	return _pageList.empty();
 }
 
+bool Book::scanning() const
+{
+	return _scanMergedBatch != _scanBatchCount;
+}
+
 const BookInfo& Book::info() const
 {
 	return _info;
@@ -161,54 +241,321 @@ const ImageInfo& Book::toPage(int num)
 	return _pageList.at(_pageNum);
 }
 
+void Book::scan(const QStringList& filelist,
+		const std::vector<FileStat>& stats, int browsed)
+{
+	_scanCancelled = false;
+	_scanFiles = filelist;
+	_scanStats = stats;
+	_scanPages = std::vector<ImageInfo>(filelist.size());
+	_scanBrowsed = std::vector<char>(filelist.size(), false);
+	_scanFirst = browsed;
+	_scanInsertPos = 0;
+	_scanBatchCount = (filelist.size() + kScanBatchSize - 1) / kScanBatchSize;
+	_scanNextBatch = 0;
+	_scanBatchDone = std::vector<char>(_scanBatchCount, false);
+	_scanMergedBatch = 0;
+
+	/* Every worker takes the next batch until all batches are taken, so the
+	 * files are browsed roughly in order. */
+	int generation = ++_scanGeneration;
+	int worker_count = std::min(_scanPool.maxThreadCount(), _scanBatchCount);
+	for (int i = 0; i != worker_count; ++i)
+		_scanPool.start([this, generation]() { scanBatches(generation); });
+}
+
+void Book::scanBatches(int generation)
+{
+	for (int batch = _scanNextBatch++; batch < _scanBatchCount;
+			batch = _scanNextBatch++) {
+		if (_scanCancelled)
+			return;
+		int end = std::min((batch + 1) * kScanBatchSize,
+				static_cast<int>(_scanFiles.size()));
+		browseBatch(batch * kScanBatchSize, end);
+		QMetaObject::invokeMethod(this, [this, generation, batch]() {
+					mergeBatch(generation, batch);
+				}, Qt::QueuedConnection);
+	}
+}
+
+void Book::browseBatch(int begin, int end)
+{
+	if (_archive) {
+		for (int i = begin; i != end && !_scanCancelled; ++i) {
+			if (i != _scanFirst) {
+				_scanBrowsed[i] = browsePage(_scanFiles.at(i), _scanStats[i],
+						&_scanPages[i]);
+			}
+		}
+		return;
+	}
+
+	/* The status was got when listing the directory, restore the indexed
+	 * pages with it. */
+	QStringList unindexed;
+	std::vector<int> indices;
+	for (int i = begin; i != end; ++i) {
+		if (i == _scanFirst)
+			continue;
+		const FileStat& stat = _scanStats[i];
+		if (_index.restore(_scanFiles.at(i), stat.size, stat.lastModified,
+					&_scanPages[i])) {
+			_scanBrowsed[i] = true;
+			continue;
+		}
+		unindexed.append(_scanFiles.at(i));
+		indices.push_back(i);
+	}
+	if (unindexed.isEmpty() || _scanCancelled)
+		return;
+
+	/* Read the heads of the others together, most headers are in them. */
+	std::vector<QByteArray> heads = readFileHeads(unindexed, kHeadSize);
+	for (std::size_t k = 0; k != indices.size(); ++k) {
+		int i = indices[k];
+		const FileStat& stat = _scanStats[i];
+		_scanBrowsed[i] = !heads[k].isNull() && _scanPages[i].browse(
+				_scanFiles.at(i), heads[k], stat.size, stat.lastModified);
+	}
+}
+
+void Book::mergeBatch(int generation, int batch)
+{
+	if (generation != _scanGeneration)
+		return;
+
+	_scanBatchDone[batch] = true;
+	if (batch != _scanMergedBatch)
+		return;
+
+	for (; _scanMergedBatch != _scanBatchCount
+			&& _scanBatchDone[_scanMergedBatch]; ++_scanMergedBatch) {
+		int end = std::min((_scanMergedBatch + 1) * kScanBatchSize,
+				static_cast<int>(_scanFiles.size()));
+		for (int i = _scanMergedBatch * kScanBatchSize; i != end; ++i) {
+			if (!_scanBrowsed[i])
+				continue;
+			if (i > _scanFirst) {
+				_pageList.emplace_back(std::move(_scanPages[i]));
+				continue;
+			}
+			if (_pageNum >= _scanInsertPos)
+				++_pageNum;
+			_pageList.insert(_scanInsertPos++, std::move(_scanPages[i]));
+		}
+	}
+	emit pagesAdded();
+
+	if (_scanMergedBatch == _scanBatchCount) {
+		_scanFiles.clear();
+		_scanStats.clear();
+		_scanPages.clear();
+		_scanBrowsed.clear();
+		_scanBatchDone.clear();
+		gDebug() << "Finished opening," << _pageList.size() << "pages.";
+		if (!_archive) {
+			_index.update(_pageList);
+			_index.save();
+		}
+		emit scanFinished();
+
+		/* The changed files may have been listed before or after they
+		 * changed, compare the whole directory. */
+		if (_refreshPending) {
+			_refreshPending = false;
+			refresh(QStringList());
+		}
+	}
+}
+
+bool Book::browsePage(const QString& path, const FileStat& stat,
+		ImageInfo* page) const
+{
+	if (_archive) {
+		int index = _archive->find(path.mid(_archive->path().size() + 1));
+		return index != -1 && page->browse(*_archive, index);
+	}
+	if (_index.restore(path, stat.size, stat.lastModified, page))
+		return true;
+	QByteArray head = readFileHeads({ path }, kHeadSize).front();
+	return !head.isNull()
+		&& page->browse(path, head, stat.size, stat.lastModified);
+}
+
+void Book::cancelScan()
+{
+	_scanCancelled = true;
+	_scanPool.waitForDone();
+	++_scanGeneration;
+	_scanBatchCount = _scanMergedBatch = 0;
+}
+
 void Book::sortPages(Sort sort)
 {
-	switch (sort) {
-	case Sort::NameAscending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.filename() < rhs.filename();
-				});
-		break;
-	case Sort::NameDescending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.filename() > rhs.filename();
-				});
-		break;
-	case Sort::DateAscending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.lastModified() < rhs.lastModified();
-				});
-		break;
-	case Sort::DateDescending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.lastModified() > rhs.lastModified();
-				});
-		break;
-	case Sort::SizeAscending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.size() < rhs.size();
-				});
-		break;
-	case Sort::SizeDescending:
-		std::sort(_pageList.begin(), _pageList.end(),
-				[](const ImageInfo& lhs, const ImageInfo& rhs) {
-					return lhs.size() > rhs.size();
-				});
-		break;
-	case Sort::Shuffle:
+	_sort = sort;
+	if (sort == Sort::Shuffle) {
 		for (int j = _pageList.size() - 1; j > 0; --j) {
 			int i = rand() % j;
 			std::swap(_pageList[i], _pageList[j]);
 		}
-		break;
-	default:
-		break;
+		return;
 	}
+	std::sort(_pageList.begin(), _pageList.end(),
+			[sort](const ImageInfo& lhs, const ImageInfo& rhs) {
+				return pageLessThan(sort, lhs, rhs);
+			});
+}
+
+void Book::refresh(const QStringList& paths)
+{
+	/* The scan adds the pages listed before, wait for it so the changes are
+	 * not overwritten. */
+	if (scanning()) {
+		_refreshPending = true;
+		return;
+	}
+
+	if (!paths.isEmpty()) {
+		QStringList changed;
+		for (const QString& path : paths) {
+			if (!path.section('/', -1).startsWith('.'))
+				changed.append(path);
+		}
+		if (!changed.isEmpty())
+			applyChanges(changed, statFiles(changed));
+		return;
+	}
+
+	/* The changed files are unknown, compare the status listed with the
+	 * pages, only the differences are browsed. */
+	QHash<QString, int> pages;
+	pages.reserve(_pageList.size());
+	for (int i = 0; i != _pageList.size(); ++i)
+		pages.insert(_pageList.at(i).absPath(), i);
+
+	QStringList changed;
+	std::vector<FileStat> stats;
+	for (DirEntry& file : scanDirectory(_info.absPath())) {
+		auto iter = pages.find(file.path);
+		if (iter != pages.end()) {
+			const ImageInfo& page = _pageList.at(iter.value());
+			pages.erase(iter);
+			if (page.size() == file.stat.size
+					&& page.lastModified() == file.stat.lastModified)
+				continue;
+		}
+		changed.append(std::move(file.path));
+		stats.push_back(file.stat);
+	}
+	/* The rest are gone, the default status removes them. */
+	for (auto iter = pages.cbegin(); iter != pages.cend(); ++iter) {
+		changed.append(iter.key());
+		stats.emplace_back();
+	}
+	if (!changed.isEmpty())
+		applyChanges(changed, stats);
+}
+
+void Book::applyChanges(const QStringList& paths,
+		const std::vector<FileStat>& stats)
+{
+	/* Index the pages by their paths once, the views refer to the pages,
+	 * which are not modified until the page list is rebuilt below. */
+	std::unordered_map<std::string_view, int> pages;
+	pages.reserve(_pageList.size());
+	for (int i = 0; i != _pageList.size(); ++i)
+		pages.emplace(_pageList.at(i).pathKey(), i);
+
+	/* Mark the removed and modified pages. */
+	std::vector<char> removed(_pageList.size(), false);
+	QList<ImageInfo> stale;
+	QStringList browsing;
+	std::vector<FileStat> browsingStats;
+	for (int k = 0; k != paths.size(); ++k) {
+		const QString& path = paths.at(k);
+		const FileStat& stat = stats[k];
+		QByteArray key = path.toUtf8();
+		auto found = pages.find(std::string_view(key.constData(), key.size()));
+		if (found != pages.end()) {
+			const ImageInfo& page = _pageList.at(found->second);
+			if (stat.regular && page.size() == stat.size
+					&& page.lastModified() == stat.lastModified)
+				continue;
+			removed[found->second] = true;
+			stale.append(page);
+		}
+		if (stat.regular) {
+			browsing.append(path);
+			browsingStats.push_back(stat);
+		}
+	}
+
+	/* Browse the added and modified files. */
+	std::vector<ImageInfo> added;
+	std::vector<QByteArray> heads = readFileHeads(browsing, kHeadSize);
+	for (int k = 0; k != browsing.size(); ++k) {
+		ImageInfo page;
+		const FileStat& stat = browsingStats[k];
+		if (!heads[k].isNull() && page.browse(browsing.at(k), heads[k],
+					stat.size, stat.lastModified))
+			added.push_back(std::move(page));
+	}
+	if (stale.isEmpty() && added.empty())
+		return;
+
+	/* Merge the new pages into the rest in the sort order in one pass, the
+	 * shuffled pages are appended. _pageNum follows the current page, or
+	 * the page after it when it is taken out. */
+	bool shuffled = _sort == Sort::Shuffle;
+	if (!shuffled) {
+		std::stable_sort(added.begin(), added.end(),
+				[this](const ImageInfo& lhs, const ImageInfo& rhs) {
+					return pageLessThan(_sort, lhs, rhs);
+				});
+	}
+	bool curPageChanged = _pageNum == -1 || removed[_pageNum];
+	QByteArray curKey = _pageNum == -1 ? QByteArray()
+		: QByteArray(_pageList.at(_pageNum).pathKey().data(),
+				_pageList.at(_pageNum).pathKey().size());
+	int pageNum = -1;
+	bool curReadded = false;
+	QList<ImageInfo> pageList;
+	pageList.reserve(_pageList.size() - stale.size() + added.size());
+	auto next = added.begin();
+	auto appendAdded = [&]() {
+		/* Stay at the modified current page. */
+		if (curPageChanged && !curKey.isEmpty() && next->pathKey()
+				== std::string_view(curKey.constData(), curKey.size())) {
+			pageNum = pageList.size();
+			curReadded = true;
+		}
+		pageList.append(std::move(*next++));
+	};
+	for (int i = 0; i != _pageList.size(); ++i) {
+		if (removed[i]) {
+			/* Unless it is already back earlier in the order. */
+			if (i == _pageNum && !curReadded)
+				pageNum = pageList.size();
+			continue;
+		}
+		while (!shuffled && next != added.end()
+				&& pageLessThan(_sort, *next, _pageList.at(i)))
+			appendAdded();
+		if (i == _pageNum)
+			pageNum = pageList.size();
+		pageList.append(std::move(_pageList[i]));
+	}
+	while (next != added.end())
+		appendAdded();
+
+	_pageList = std::move(pageList);
+	_pageNum = _pageList.empty() ? -1 : std::clamp(pageNum, 0,
+			static_cast<int>(_pageList.size()) - 1);
+
+	gDebug() << "Refreshed book," << stale.size() << "pages removed or"
+		<< "modified," << added.size() << "pages added.";
+	emit pagesChanged(stale, curPageChanged);
 }
 
 }  /* img_view */
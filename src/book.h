@@ -6,35 +6,60 @@
 #ifndef BOOK_H
 #define BOOK_H
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <QObject>
 #include <QList>
 #include <QImage>
+#include <QThreadPool>
 
+#include "batch_io.h"
 #include "book_info.h"
+#include "book_watcher.h"
 #include "image_info.h"
 #include "options.h"
+#include "page_index.h"
+#include "zip_archive.h"
 
 namespace img_view {
 
 /*
- * A directory is considered as a book, all images in it are considered as
- * pages.
+ * A directory or a ZIP (CBZ) archive is considered as a book, all images in it
+ * are considered as pages.
  */
-class Book {
+class Book : public QObject {
+	Q_OBJECT
+
 public:
-	Book();
+	explicit Book(QObject* parent = nullptr);
 	~Book();
 
 	/**
-	 * @brief Open the specified book (directory).
+	 * @brief Open the specified book (directory or archive).
+	 *
+	 * Only the page PAGE (or the first page when PAGE is not an image in the
+	 * book) is browsed before returning, it becomes the current page. The
+	 * other pages are browsed in background and added to the page list in
+	 * batches, see pagesAdded() and scanFinished().
+	 *
+	 * The directory of the book is watched afterwards, the added, removed and
+	 * modified files are applied to the page list, see pagesChanged().
+	 * Archives are not watched.
 	 *
 	 * NOTE: remember to call close() before open a new book.
 	 *
+	 * @param book The absolute path of the book
+	 * @param page The absolute path of the page to open the book at
+	 *
 	 * @return True when success
 	 */
-	bool open(const QString& book);
+	bool open(const QString& book, const QString& page = QString());
 
 	/**
-	 * @brief Close book.
+	 * @brief Close book, the scan of the pages is cancelled if it is still
+	 *        running and the directory is no longer watched.
 	 */
 	void close();
 
@@ -45,6 +70,13 @@ public:
 	 */
 	bool empty() const;
 
+	/**
+	 * @brief Check if the pages are still being browsed in background.
+	 *
+	 * @return True when the page list is incomplete
+	 */
+	bool scanning() const;
+
 	/**
 	 * @brief Get the book's information.
 	 *
@@ -175,19 +207,145 @@ public:
 	const ImageInfo& toPage(int num);
 
 	/**
-	 * @brief Sort pages by SORT.
+	 * @brief Sort pages by SORT, the pages added later are inserted in this
+	 *        order.
 	 *
 	 * @param sort Sort option.
 	 */
 	void sortPages(Sort sort);
 
+signals:
+	/**
+	 * @brief Emitted when some pages are added to the page list, the current
+	 *        page keeps unchanged but its number may change.
+	 */
+	void pagesAdded();
+
+	/**
+	 * @brief Emitted when all pages have been browsed.
+	 */
+	void scanFinished();
+
+	/**
+	 * @brief Emitted when the page list has been refreshed with the changes
+	 *        of the files in the book.
+	 *
+	 * @param stale The pages removed, and the modified pages as they were
+	 *        before, whose images are out of date
+	 * @param curPageChanged The current page has been removed or modified,
+	 *        or the book was empty
+	 */
+	void pagesChanged(const QList<ImageInfo>& stale, bool curPageChanged);
+
+private slots:
+	/**
+	 * @brief Apply the changes of the files PATHS to the page list, the
+	 *        current page and the sort order are kept. Only PATHS are
+	 *        checked, the whole directory is compared with the page list
+	 *        when PATHS is empty.
+	 *
+	 * It is delayed until the scan finishes if it is still running.
+	 *
+	 * @param paths The absolute paths of the files added, removed or modified
+	 */
+	void refresh(const QStringList& paths);
+
 private:
+	/**
+	 * @brief Apply the status STATS of the files PATHS to the page list, see
+	 *        refresh(). The files failing to stat are removed.
+	 */
+	void applyChanges(const QStringList& paths,
+			const std::vector<FileStat>& stats);
+
+	/**
+	 * @brief Browse the files in FILELIST in parallel, the images are added to
+	 *        the page list in the order of FILELIST.
+	 *
+	 * @param filelist The absolute paths of the files to browse
+	 * @param stats The status of the files, unused for archives
+	 * @param browsed The index of the file already in the page list
+	 */
+	void scan(const QStringList& filelist, const std::vector<FileStat>& stats,
+			int browsed);
+
+	/**
+	 * @brief Browse the batches of files until all are taken, run in the
+	 *        worker threads.
+	 *
+	 * @param generation The generation of the scan
+	 */
+	void scanBatches(int generation);
+
+	/**
+	 * @brief Browse the files in [BEGIN, END) of the scan, the file system
+	 *        requests of them are batched.
+	 */
+	void browseBatch(int begin, int end);
+
+	/**
+	 * @brief Add the pages of the browsed batch BATCH to the page list, the
+	 *        batches are added in order, so it may be delayed until all
+	 *        batches before it are browsed.
+	 *
+	 * @param generation The generation of the scan, the batch is dropped if
+	 *        it is not the current one
+	 * @param batch The batch number
+	 */
+	void mergeBatch(int generation, int batch);
+
+	/**
+	 * @brief Get the information of the page PATH from the index, or browse
+	 *        it when it is not indexed or has changed. The pages of archives
+	 *        are browsed in the archives.
+	 *
+	 * @param stat The status of PATH got when listing the book
+	 *
+	 * @return True when PATH is an image
+	 */
+	bool browsePage(const QString& path, const FileStat& stat,
+			ImageInfo* page) const;
+
+	/**
+	 * @brief Cancel the running scan and wait for the workers to finish.
+	 */
+	void cancelScan();
 
 private:
 	BookInfo _info;  /* This book's information. */
 	/* Information of all pages inside this book. */
 	QList<ImageInfo> _pageList;
 	int _pageNum = -1;
+	/* Information of the pages saved last time. */
+	PageIndex _index;
+	/* The opened archive when the book is an archive. */
+	std::shared_ptr<ZipArchive> _archive;
+	/* The order to insert the pages added later. */
+	Sort _sort = Sort::NameAscending;
+
+	/* Watch the directory of the book for changes. */
+	BookWatcher _watcher;
+	/* Files changed while scanning, the book is refreshed after it. */
+	bool _refreshPending = false;
+
+	QThreadPool _scanPool;  /* Workers to browse pages. */
+	std::atomic_bool _scanCancelled = false;
+	/* Increase on every scan to drop the batches of the cancelled ones. */
+	int _scanGeneration = 0;
+	/* The files being browsed and the results. */
+	QStringList _scanFiles;
+	std::vector<FileStat> _scanStats;
+	std::vector<ImageInfo> _scanPages;
+	std::vector<char> _scanBrowsed;
+	/* The file already in the page list before scanning, files before it are
+	 * inserted in front of it, files after it are appended. */
+	int _scanFirst = -1;
+	int _scanInsertPos = 0;
+	/* Batches are taken by the workers in order and merged in order. */
+	int _scanBatchCount = 0;
+	std::atomic<int> _scanNextBatch = 0;
+	std::vector<char> _scanBatchDone;
+	int _scanMergedBatch = 0;
 };
 
 }  /* img_view */
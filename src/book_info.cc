@@ -5,32 +5,78 @@
  */
 #include "book_info.h"
 
+#include <algorithm>
+
 #include <QFileInfo>
 #include <QDir>
 
+#include "batch_io.h"
 #include "image_info.h"
+#include "zip_archive.h"
 
 namespace img_view {
 
-bool BookInfo::browse(const QString& book)
+/* Number of files sniffed at a time to find the cover. */
+static constexpr qsizetype kSniffBatchSize = 8;
+
+bool BookInfo::browse(const QString& book, std::vector<DirEntry>* files)
 {
 	QFileInfo info(book);
-	if (!info.exists() || !info.isDir() || !info.isReadable())
+	if (!info.exists() || !info.isReadable())
+		return false;
+	if (info.isFile())
+		return browseArchive(book);
+	if (!info.isDir())
 		return false;
 	_lastModified = info.lastModified().toMSecsSinceEpoch();
 
 	QDir dir(book);
 	_absPath = dir.absolutePath().toUtf8();
 	_bookname = dir.dirName().toUtf8();
-	QStringList filelist = dir.entryList(QDir::Files | QDir::Readable,
-			QDir::Name);
-	QString filepath;
-	for (const QString& filename : filelist) {
-		filepath = dir.filePath(filename);
-		if (getImageFormat(filepath) == ImageFormat::unknown)
+	std::vector<DirEntry> filelist = scanDirectory(dir.absolutePath());
+	/* Sniff a few files at a time, the cover is usually the first one. */
+	qsizetype count = static_cast<qsizetype>(filelist.size());
+	for (qsizetype begin = 0; begin < count && _coverFilepath.isEmpty();
+			begin += kSniffBatchSize) {
+		qsizetype end = std::min(begin + kSniffBatchSize, count);
+		QStringList paths;
+		for (qsizetype i = begin; i != end; ++i)
+			paths.append(filelist[i].path);
+		std::vector<QByteArray> heads = readFileHeads(paths, kSniffSize);
+		for (qsizetype i = begin; i != end; ++i) {
+			const QByteArray& head = heads[i - begin];
+			if (getImageFormat(head.constData(), head.size())
+					== ImageFormat::unknown)
+				continue;
+			_coverFilepath = filelist[i].path.toUtf8();
+			_coverFilename = filelist[i].name.toUtf8();
+			break;
+		}
+	}
+	if (files)
+		*files = std::move(filelist);
+	return true;
+}
+
+bool BookInfo::browseArchive(const QString& archive)
+{
+	std::shared_ptr<ZipArchive> zip = ZipArchive::open(archive);
+	if (!zip)
+		return false;
+
+	QFileInfo info(zip->path());
+	_lastModified = info.lastModified().toMSecsSinceEpoch();
+	_absPath = zip->path().toUtf8();
+	_bookname = info.fileName().toUtf8();
+	_archive = true;
+	/* Only the beginning of the members is inflated to get their formats. */
+	for (const QString& name : zip->names()) {
+		QByteArray head = zip->read(zip->find(name), kSniffSize);
+		if (getImageFormat(head.constData(), head.size())
+				== ImageFormat::unknown)
 			continue;
-		_coverFilepath = filepath.toUtf8();
-		_coverFilename = filename.toUtf8();
+		_coverFilepath = _absPath + '/' + name.toUtf8();
+		_coverFilename = name.mid(name.lastIndexOf('/') + 1).toUtf8();
 		break;
 	}
 	return true;
@@ -66,4 +112,9 @@ qint64 BookInfo::lastModified() const
 	return _lastModified;
 }
 
+bool BookInfo::isArchive() const
+{
+	return _archive;
+}
+
 }  /* img_view */
@@ -6,8 +6,12 @@
 #ifndef BOOK_INFO_H
 #define BOOK_INFO_H
 
+#include <vector>
+
 #include <QString>
 
+#include "dir_scanner.h"
+
 namespace img_view {
 
 class BookInfo {
@@ -18,12 +22,20 @@ public:
 	/**
 	 * @brief Browse a book and get its information.
 	 *
-	 * @param book The directory path to browse
+	 * @param book The directory or the ZIP (CBZ) archive path to browse
+	 * @param files Where to store the files of a directory book sorted by
+	 *        name, so they don't need to be listed again
 	 *
-	 * @return True when succeeded, false when the path is not exist, is not a
-	 *         directory, or you don't have the permission to open it
+	 * @return True when succeeded, false when the path is not exist, is
+	 *         neither a directory nor an archive, or you don't have the
+	 *         permission to open it
+	 */
+	bool browse(const QString& book, std::vector<DirEntry>* files = nullptr);
+
+	/**
+	 * @brief Check if the book is an archive.
 	 */
-	bool browse(const QString& book);
+	bool isArchive() const;
 
 	/**
 	 * @brief Check whether is no book has been browsed now.
@@ -59,6 +71,12 @@ public:
 	 */
 	qint64 lastModified() const;
 
+private:
+	/**
+	 * @brief Browse the archive ARCHIVE as a book.
+	 */
+	bool browseArchive(const QString& archive);
+
 private:
 	QByteArray _absPath;
 	QByteArray _bookname;
@@ -66,6 +84,7 @@ private:
 	QByteArray _coverFilepath;
 	QByteArray _coverFilename;
 	qint64 _lastModified = 0;
+	bool _archive = false;
 };
 
 }  /* img_view */
@@ -0,0 +1,134 @@
+/**
+ * book_watcher.cc
+ *
+ * Created by vamirio on 2022 Nov 19
+ */
+#include "book_watcher.h"
+
+#include <algorithm>
+
+#include <QDir>
+#include <QFile>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#include <unistd.h>
+#define BOOK_WATCHER_INOTIFY
+#endif
+
+#include "debug.h"
+
+namespace img_view {
+
+BookWatcher::BookWatcher(QObject* parent) : QObject(parent)
+{
+	_settleTimer.setSingleShot(true);
+	connect(&_settleTimer, &QTimer::timeout, this, &BookWatcher::onSettled);
+	connect(&_fallback, &QFileSystemWatcher::directoryChanged,
+			this, &BookWatcher::onDirectoryChanged);
+}
+
+BookWatcher::~BookWatcher()
+{
+	stop();
+}
+
+bool BookWatcher::watch(const QString& dir)
+{
+	stop();
+	_dir = dir;
+
+#ifdef BOOK_WATCHER_INOTIFY
+	/* Files written in place are reported when closed, the others when
+	 * moved in, so half written files are never seen. The directory itself
+	 * being removed or renamed takes all pages away. */
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (_fd >= 0 && inotify_add_watch(_fd, QFile::encodeName(dir).constData(),
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE
+				| IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF
+				| IN_ONLYDIR) >= 0) {
+		_notifier = new QSocketNotifier(_fd, QSocketNotifier::Read, this);
+		connect(_notifier, &QSocketNotifier::activated,
+				this, &BookWatcher::onEvents);
+		return true;
+	}
+	gWarn() << "Failed to watch" << dir << "by inotify.";
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+#endif
+
+	return _fallback.addPath(dir);
+}
+
+void BookWatcher::stop()
+{
+	delete _notifier;
+	_notifier = nullptr;
+#ifdef BOOK_WATCHER_INOTIFY
+	if (_fd >= 0)
+		close(_fd);
+#endif
+	_fd = -1;
+	if (!_fallback.directories().isEmpty())
+		_fallback.removePaths(_fallback.directories());
+
+	_settleTimer.stop();
+	_pending.invalidate();
+	_changed.clear();
+	_unknown = false;
+	_dir.clear();
+}
+
+void BookWatcher::onEvents()
+{
+#ifdef BOOK_WATCHER_INOTIFY
+	alignas(inotify_event) char buf[4096];
+	QDir dir(_dir);
+	for (;;) {
+		ssize_t len = read(_fd, buf, sizeof(buf));
+		if (len <= 0)
+			break;
+		for (char* p = buf; p < buf + len; ) {
+			const inotify_event* event = reinterpret_cast<inotify_event*>(p);
+			p += sizeof(inotify_event) + event->len;
+			if (event->mask
+					& (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF))
+				_unknown = true;
+			else if (event->len != 0 && !(event->mask & IN_ISDIR))
+				_changed.insert(dir.filePath(QFile::decodeName(event->name)));
+		}
+	}
+	if (_unknown || !_changed.isEmpty())
+		settle();
+#endif
+}
+
+void BookWatcher::onDirectoryChanged()
+{
+	_unknown = true;
+	settle();
+}
+
+void BookWatcher::onSettled()
+{
+	QStringList paths;
+	if (!_unknown)
+		paths = _changed.values();
+	_pending.invalidate();
+	_changed.clear();
+	_unknown = false;
+	gDebug() << "Files changed in" << _dir << ":"
+		<< (paths.isEmpty() ? QStringList("unknown") : paths);
+	emit filesChanged(paths);
+}
+
+void BookWatcher::settle()
+{
+	if (!_pending.isValid())
+		_pending.start();
+	qint64 left = std::max<qint64>(kMaxSettleDelay - _pending.elapsed(), 0);
+	_settleTimer.start(static_cast<int>(std::min<qint64>(kSettleDelay, left)));
+}
+
+}  /* img_view */
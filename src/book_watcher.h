@@ -0,0 +1,101 @@
+/**
+ * book_watcher.h
+ *
+ * Watch the directory of a book and report the changed files, so the book
+ * can be refreshed without browsing all pages again. inotify is used on
+ * Linux, QFileSystemWatcher elsewhere.
+ *
+ * Created by vamirio on 2022 Nov 19
+ */
+#ifndef BOOK_WATCHER_H
+#define BOOK_WATCHER_H
+
+#include <QElapsedTimer>
+#include <QFileSystemWatcher>
+#include <QObject>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+
+namespace img_view {
+
+class BookWatcher : public QObject {
+	Q_OBJECT
+
+public:
+	explicit BookWatcher(QObject* parent = nullptr);
+	~BookWatcher();
+
+	BookWatcher(const BookWatcher&) = delete;
+	BookWatcher& operator=(const BookWatcher&) = delete;
+
+	/**
+	 * @brief Watch the directory DIR instead of the previous one.
+	 *
+	 * @return False when DIR can't be watched
+	 */
+	bool watch(const QString& dir);
+
+	/**
+	 * @brief Stop watching, the pending changes are dropped.
+	 */
+	void stop();
+
+signals:
+	/**
+	 * @brief Emitted when the files in the directory have changed, the
+	 *        changes in a short time are reported together.
+	 *
+	 * @param paths The absolute paths of the files which may have been added,
+	 *        removed or modified. It is empty when they are unknown, the
+	 *        whole directory has to be checked then.
+	 */
+	void filesChanged(const QStringList& paths);
+
+private slots:
+	/**
+	 * @brief Read the inotify events.
+	 */
+	void onEvents();
+
+	/**
+	 * @brief Fallback of onEvents() with QFileSystemWatcher, which doesn't
+	 *        tell the changed files.
+	 */
+	void onDirectoryChanged();
+
+	/**
+	 * @brief Report the changes collected.
+	 */
+	void onSettled();
+
+private:
+	/**
+	 * @brief (Re)start the settle timer for the changes just collected.
+	 */
+	void settle();
+
+	QString _dir;
+	int _fd = -1;
+	QSocketNotifier* _notifier = nullptr;
+	QFileSystemWatcher _fallback;
+
+	/* Files are usually written in bursts, wait until it settles, but not
+	 * longer than kMaxSettleDelay since the first change for the burst
+	 * which never does, e.g. a long download. */
+	QTimer _settleTimer;
+	QElapsedTimer _pending;
+	QSet<QString> _changed;
+	/* The changed files are unknown, e.g. the events overflowed or the
+	 * directory itself was removed or renamed. */
+	bool _unknown = false;
+
+	static constexpr int kSettleDelay = 300;
+	static constexpr int kMaxSettleDelay = 2500;
+};
+
+}  /* img_view */
+
+#endif /* ifndef BOOK_WATCHER_H */
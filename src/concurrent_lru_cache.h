@@ -0,0 +1,330 @@
+/**
+ * concurrent_lru_cache.h
+ *
+ * Thread-safe LRU (Least Recently Used) Cache Class
+ *
+ * Created by vamirio on 2022 Sep 03
+ */
+#ifndef CONCURRENT_LRU_CACHE_H
+#define CONCURRENT_LRU_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include "lru_cache.h"
+
+namespace img_view
+{
+
+/*
+ * The items are distributed to SHARD_COUNT LruCache shards by the hash of
+ * their keys, every shard has its own lock, so threads working on different
+ * shards don't block each other. The max cost is shared by all shards, every
+ * item is stamped with a global counter when used, and when the max cost is
+ * exceeded, the least recently used item of the shard whose one is the oldest
+ * is evicted, so the order of eviction is LRU across the shards.
+ */
+template <typename Key, typename Value, typename Cost = UnitCost<Value>,
+		typename Traits = LruKeyTraits<Key>, std::size_t SHARD_COUNT = 8>
+class ConcurrentLruCache {
+public:
+	typedef typename Traits::View KeyView;
+
+public:
+	/**
+	 * @param maxCost Max total cost of cache items.
+	 */
+	ConcurrentLruCache(std::size_t maxCost = 30) : _maxCost(maxCost)
+	{
+		/* The shards are bounded by the total cost. */
+		for (Shard& shard : _shards)
+			shard.cache.setMaxCost(std::numeric_limits<std::size_t>::max());
+	}
+	~ConcurrentLruCache() {}
+
+	ConcurrentLruCache(const ConcurrentLruCache&) = delete;
+	ConcurrentLruCache& operator=(const ConcurrentLruCache&) = delete;
+
+	/**
+	 * @brief Get the value corresponding with the KEY.
+	 *
+	 * @return A copy of the value corresponding with the KEY, or the default
+	 *         construct object of Value class when there is none.
+	 */
+	Value get(const Key& key)
+	{
+		Shard& shard = shardOf(Traits::view(key));
+		std::lock_guard<std::mutex> locker(shard.mutex);
+		const Entry* entry = findLocked(shard, key);
+		return entry ? entry->value : Value();
+	}
+
+	/**
+	 * @brief Get the value corresponding with the key whose view is VIEW,
+	 *        without constructing a key.
+	 *
+	 * @return The same as get().
+	 */
+	Value lookup(const KeyView& view)
+	{
+		Shard& shard = shardOf(view);
+		std::lock_guard<std::mutex> locker(shard.mutex);
+		const Entry* entry = shard.cache.findView(view);
+		if (!entry)
+			return Value();
+		entry->lastUsed = ++_clock;
+		return entry->value;
+	}
+
+	/**
+	 * @brief Put the specified KEY - VALUE pair into cache, the value is
+	 *        replaced if KEY is already in cache.
+	 */
+	void put(const Key& key, const Value& value)
+	{
+		Shard& shard = shardOf(Traits::view(key));
+		std::unique_lock<std::mutex> locker(shard.mutex);
+		putLocked(shard, key, value);
+		locker.unlock();
+		trim(&shard);
+	}
+
+	/**
+	 * @brief Get the value corresponding with the KEY, compute and cache it
+	 *        when it is not in cache.
+	 *
+	 * Concurrent calls for the same key are coalesced, only one of them
+	 * computes, the others wait for its result.
+	 *
+	 * @param compute A functor returns std::optional<Value>, the value is not
+	 *        cached when it returns std::nullopt. It is called without any
+	 *        lock held.
+	 *
+	 * @return The value, or the default construct object of Value class when
+	 *         COMPUTE failed.
+	 */
+	Value getOrCompute(const Key& key,
+			const std::function<std::optional<Value>()>& compute)
+	{
+		KeyView view = Traits::view(key);
+		Shard& shard = shardOf(view);
+		std::unique_lock<std::mutex> locker(shard.mutex);
+		if (const Entry* entry = findLocked(shard, key))
+			return entry->value;
+
+		auto computing = shard.computing.find(view);
+		if (computing != shard.computing.end()) {
+			std::shared_future<Value> result = computing->second;
+			locker.unlock();
+			++_coalesced;
+			return result.get();
+		}
+
+		/* The view refers to KEY, it is valid until the computation is
+		 * removed below. */
+		std::promise<Value> promise;
+		shard.computing.emplace(view, promise.get_future().share());
+		locker.unlock();
+
+		std::optional<Value> value;
+		try {
+			value = compute();
+		} catch (...) {
+			locker.lock();
+			shard.computing.erase(view);
+			locker.unlock();
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+
+		locker.lock();
+		shard.computing.erase(view);
+		if (value)
+			putLocked(shard, key, *value);
+		locker.unlock();
+		if (value)
+			trim(&shard);
+
+		promise.set_value(value ? *value : Value());
+		return value ? *value : Value();
+	}
+
+	/**
+	 * @brief Remove the item whose key's view is VIEW, a computation of it in
+	 *        progress is not affected.
+	 *
+	 * @return False when there is no such item
+	 */
+	bool erase(const KeyView& view)
+	{
+		Shard& shard = shardOf(view);
+		std::lock_guard<std::mutex> locker(shard.mutex);
+		std::size_t cost = shard.cache.cost();
+		if (!shard.cache.erase(view))
+			return false;
+		_cost -= cost - shard.cache.cost();
+		return true;
+	}
+
+	/**
+	 * @brief Set the max total cost of cache items, remove the least recently
+	 *        used items if the total cost exceeds it.
+	 */
+	void setMaxCost(std::size_t maxCost)
+	{
+		_maxCost = maxCost;
+		trim(nullptr);
+	}
+
+	/**
+	 * @brief Get the max total cost of cache items.
+	 */
+	std::size_t maxCost() const { return _maxCost; }
+
+	/**
+	 * @brief Get the total cost of cache items.
+	 */
+	std::size_t cost() const { return _cost; }
+
+	/**
+	 * @brief Get the number of lookups which found the key.
+	 */
+	std::size_t hits()
+	{
+		return sum(&Cache::hits);
+	}
+
+	/**
+	 * @brief Get the number of lookups which didn't find the key.
+	 */
+	std::size_t misses()
+	{
+		return sum(&Cache::misses);
+	}
+
+	/**
+	 * @brief Get the number of items removed to keep the total cost within
+	 *        the max cost.
+	 */
+	std::size_t evictions()
+	{
+		return sum(&Cache::evictions);
+	}
+
+	/**
+	 * @brief Get the number of getOrCompute() which waited for the
+	 *        computation of another one.
+	 */
+	std::size_t coalesced() const { return _coalesced; }
+
+private:
+	/* A cached value and when it was used last time, the stamp is updated
+	 * on hits with the lock of its shard held. */
+	struct Entry {
+		Value value;
+		mutable std::uint64_t lastUsed;
+	};
+	struct EntryCost {
+		std::size_t operator()(const Entry& entry) const
+		{
+			return Cost()(entry.value);
+		}
+	};
+	typedef LruCache<Key, Entry, EntryCost, Traits> Cache;
+
+	struct Shard {
+		std::mutex mutex;
+		Cache cache;
+		/* Results of the computations in progress. */
+		std::unordered_map<KeyView, std::shared_future<Value>> computing;
+	};
+
+	Shard& shardOf(const KeyView& view)
+	{
+		return _shards[std::hash<KeyView>{}(view) % SHARD_COUNT];
+	}
+
+	/* Find KEY in SHARD whose lock is held and stamp it, a stale item
+	 * removed by the lookup is taken off the total cost. */
+	const Entry* findLocked(Shard& shard, const Key& key)
+	{
+		std::size_t cost = shard.cache.cost();
+		const Entry* entry = shard.cache.find(key);
+		_cost -= cost - shard.cache.cost();
+		if (entry)
+			entry->lastUsed = ++_clock;
+		return entry;
+	}
+
+	/* Put KEY - VALUE into SHARD whose lock is held. */
+	void putLocked(Shard& shard, const Key& key, const Value& value)
+	{
+		std::size_t cost = shard.cache.cost();
+		shard.cache.put(key, Entry{ value, ++_clock });
+		_cost += shard.cache.cost() - cost;
+	}
+
+	/* Evict the least recently used items of all shards until the total
+	 * cost is within the max cost, the most recently used item of KEEP is
+	 * kept. */
+	void trim(Shard* keep)
+	{
+		while (_cost > _maxCost) {
+			/* The oldest item of every shard is at its head, compare their
+			 * stamps to find the oldest one of all. */
+			Shard* victim = nullptr;
+			std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+			for (Shard& shard : _shards) {
+				std::lock_guard<std::mutex> locker(shard.mutex);
+				if (shard.cache.size() <= (&shard == keep ? 1 : 0))
+					continue;
+				std::uint64_t lastUsed = shard.cache.oldest()->lastUsed;
+				if (lastUsed < oldest) {
+					oldest = lastUsed;
+					victim = &shard;
+				}
+			}
+			if (!victim)
+				return;
+
+			/* The shard may have changed meanwhile, evicting its current
+			 * head is still close enough. */
+			std::lock_guard<std::mutex> locker(victim->mutex);
+			std::size_t cost = victim->cache.cost();
+			if (victim->cache.size() > (victim == keep ? 1 : 0)
+					&& victim->cache.evict())
+				_cost -= cost - victim->cache.cost();
+		}
+	}
+
+	/* Sum the statistics STAT of all shards. */
+	std::size_t sum(std::size_t (Cache::*stat)() const)
+	{
+		std::size_t ret = 0;
+		for (Shard& shard : _shards) {
+			std::lock_guard<std::mutex> locker(shard.mutex);
+			ret += (shard.cache.*stat)();
+		}
+		return ret;
+	}
+
+private:
+	Shard _shards[SHARD_COUNT];
+	std::atomic<std::size_t> _cost = 0;
+	std::atomic<std::size_t> _maxCost;
+	/* Stamps the items when they are used. */
+	std::atomic<std::uint64_t> _clock = 0;
+	std::atomic<std::size_t> _coalesced = 0;
+};
+
+};  /* img_view */
+
+#endif  /* CONCURRENT_LRU_CACHE_H */
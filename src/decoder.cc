@@ -0,0 +1,118 @@
+/**
+ * decoder.cc
+ *
+ * Created by vamirio on 2022 Aug 27
+ */
+#include "decoder.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "debug.h"
+#include "mapped_file.h"
+
+namespace img_view {
+
+Decoder::Decoder(ImageCache* cache, QObject* parent) : QObject(parent),
+	_cache(cache)
+{
+}
+
+Decoder::~Decoder()
+{
+	QMutexLocker locker(&_mutex);
+	_pending.clear();
+	locker.unlock();
+	_pool.waitForDone();
+}
+
+quint64 Decoder::decode(const ImageInfo& info, int priority, double scale)
+{
+	quint64 ticket = _nextTicket++;
+	QMutexLocker locker(&_mutex);
+	_pending.insert(ticket);
+	locker.unlock();
+
+	_pool.start([this, ticket, info, scale]() { run(ticket, info, scale); },
+			priority);
+	return ticket;
+}
+
+void Decoder::cancel(quint64 ticket)
+{
+	QMutexLocker locker(&_mutex);
+	_pending.remove(ticket);
+}
+
+bool Decoder::pending(quint64 ticket) const
+{
+	QMutexLocker locker(&_mutex);
+	return _pending.contains(ticket);
+}
+
+bool Decoder::covers(const cv::Mat& image, const ImageInfo& info,
+		double scale)
+{
+	/* Compare the long sides, the image may be rotated by its orientation. */
+	int aimed = static_cast<int>(std::max(info.width(), info.height()) * scale);
+	return !image.empty() && std::max(image.cols, image.rows) >= aimed;
+}
+
+std::optional<cv::Mat> Decoder::read(const ImageInfo& info, double scale)
+{
+	/* Let libjpeg skip the DCT coefficients that wouldn't be shown. */
+	int flags = cv::IMREAD_COLOR;
+	if (info.format() == ImageFormat::jpeg && info.width() > 0) {
+		if (scale <= 1.0 / 8)
+			flags = cv::IMREAD_REDUCED_COLOR_8;
+		else if (scale <= 1.0 / 4)
+			flags = cv::IMREAD_REDUCED_COLOR_4;
+		else if (scale <= 1.0 / 2)
+			flags = cv::IMREAD_REDUCED_COLOR_2;
+	}
+
+	/* Decode from the mapping instead of passing the path to OpenCV, which
+	 * reads it through stdio and can't open non-ASCII paths on some
+	 * platforms. imdecode() doesn't modify the data. */
+	MappedFile file;
+	cv::Mat image;
+	if (file.open(info) && file.size() <= INT_MAX) {
+		cv::Mat buf(1, static_cast<int>(file.size()), CV_8U,
+				const_cast<char*>(file.data()));
+		image = cv::imdecode(buf, flags);
+	}
+	if (image.empty()) {
+		gWarn() << "Failed to decode" << info.filename();
+		return std::nullopt;
+	}
+	return image;
+}
+
+void Decoder::run(quint64 ticket, const ImageInfo& info, double scale)
+{
+	if (!pending(ticket))
+		return;
+
+	cv::Mat image = _cache->getOrCompute(info,
+			[&info, scale]() { return read(info, scale); });
+	/* The cached image was decoded for a smaller scale, replace it. */
+	if (!image.empty() && !covers(image, info, scale)) {
+		std::optional<cv::Mat> larger = read(info, scale);
+		if (larger) {
+			image = *larger;
+			_cache->put(info, image);
+		}
+	}
+
+	/* Deliver the result in the thread of the decoder, drop it if the
+	 * request was cancelled while decoding. */
+	QMetaObject::invokeMethod(this, [this, ticket, info, image]() {
+				QMutexLocker locker(&_mutex);
+				if (!_pending.remove(ticket))
+					return;
+				locker.unlock();
+				emit decoded(ticket, info, image);
+			}, Qt::QueuedConnection);
+}
+
+}  /* img_view */
@@ -0,0 +1,109 @@
+/**
+ * decoder.h
+ *
+ * Decode images in background.
+ *
+ * Created by vamirio on 2022 Aug 27
+ */
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <optional>
+
+#include <QObject>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <opencv2/opencv.hpp>
+
+#include "concurrent_lru_cache.h"
+#include "image_info.h"
+
+namespace img_view {
+
+/* The cost of a decoded image in the cache is its size in bytes. */
+struct MatCost {
+	std::size_t operator()(const cv::Mat& mat) const
+	{
+		return mat.total() * mat.elemSize();
+	}
+};
+
+/* Decoded images shared by the GUI thread and the decoders. */
+typedef ConcurrentLruCache<ImageInfo, cv::Mat, MatCost> ImageCache;
+
+class Decoder : public QObject {
+	Q_OBJECT
+
+public:
+	/**
+	 * @param cache The cache to put the decoded images in, concurrent requests
+	 *              for the same image are decoded only once through it.
+	 */
+	explicit Decoder(ImageCache* cache, QObject* parent = nullptr);
+	~Decoder();
+
+	/**
+	 * @brief Decode the image INFO in background, the cached image is used if
+	 *        it covers SCALE.
+	 *
+	 * JPEG images are decoded at 1/2, 1/4 or 1/8 of the size when it is still
+	 * not smaller than the image scaled by SCALE.
+	 *
+	 * @param info The image to decode
+	 * @param priority Requests with higher priority are decoded first
+	 * @param scale The largest scale factor the image will be shown at,
+	 *        relative to its full size
+	 *
+	 * @return The ticket of the request, it is never 0
+	 */
+	quint64 decode(const ImageInfo& info, int priority = 0,
+			double scale = 1.0);
+
+	/**
+	 * @brief Cancel the request TICKET, the image won't be decoded if it
+	 *        hasn't been started, and decoded() won't be emitted for it.
+	 */
+	void cancel(quint64 ticket);
+
+	/**
+	 * @brief Check if the request TICKET is waiting or being decoded.
+	 */
+	bool pending(quint64 ticket) const;
+
+	/**
+	 * @brief Check if IMAGE decoded from INFO is large enough to be shown at
+	 *        SCALE relative to the full size of INFO.
+	 */
+	static bool covers(const cv::Mat& image, const ImageInfo& info,
+			double scale);
+
+signals:
+	/**
+	 * @brief Emitted in the thread of the decoder when the request TICKET is
+	 *        finished, IMAGE is empty when failed.
+	 */
+	void decoded(quint64 ticket, const ImageInfo& info, const cv::Mat& image);
+
+private:
+	/**
+	 * @brief Decode INFO for SCALE, run in the worker threads.
+	 */
+	void run(quint64 ticket, const ImageInfo& info, double scale);
+
+	/**
+	 * @brief Read INFO at the smallest size covering SCALE.
+	 */
+	static std::optional<cv::Mat> read(const ImageInfo& info, double scale);
+
+private:
+	ImageCache* _cache = nullptr;
+	QThreadPool _pool;
+	quint64 _nextTicket = 1;
+	mutable QMutex _mutex;  /* Protect _pending. */
+	QSet<quint64> _pending;
+};
+
+}  /* img_view */
+
+#endif /* ifndef DECODER_H */
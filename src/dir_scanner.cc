@@ -0,0 +1,79 @@
+/**
+ * dir_scanner.cc
+ *
+ * Created by vamirio on 2022 Nov 12
+ */
+#include "dir_scanner.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#if defined(__unix__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "debug.h"
+
+namespace img_view {
+
+std::vector<DirEntry> scanDirectory(const QString& dir)
+{
+	std::vector<DirEntry> files;
+	QDir qdir(dir);
+
+#if defined(__unix__)
+	int fd = open(QFile::encodeName(dir).constData(),
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR* stream = fd < 0 ? nullptr : fdopendir(fd);
+	if (!stream) {
+		gWarn() << "Failed to open the directory" << dir;
+		if (fd >= 0)
+			close(fd);
+		return files;
+	}
+
+	/* The entry types save the lookups of the subdirectories and the
+	 * special files, symbolic links and the unknown types are resolved by
+	 * the status. */
+	std::vector<QByteArray> names;
+	while (const dirent* entry = readdir(stream)) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (entry->d_type != DT_REG && entry->d_type != DT_LNK
+				&& entry->d_type != DT_UNKNOWN)
+			continue;
+		names.emplace_back(entry->d_name);
+	}
+
+	std::vector<FileStat> stats = statFilesAt(dirfd(stream), names);
+	closedir(stream);
+	for (std::size_t i = 0; i != names.size(); ++i) {
+		if (!stats[i].regular)
+			continue;
+		QString name = QFile::decodeName(names[i]);
+		files.push_back({ qdir.filePath(name), name, stats[i] });
+	}
+#else
+	for (const QFileInfo& info : qdir.entryInfoList(QDir::Files)) {
+		FileStat stat;
+		stat.size = info.size();
+		stat.lastModified = info.lastModified().toMSecsSinceEpoch();
+		stat.regular = true;
+		files.push_back({ info.absoluteFilePath(), info.fileName(), stat });
+	}
+#endif
+
+	std::sort(files.begin(), files.end(),
+			[](const DirEntry& lhs, const DirEntry& rhs) {
+				return lhs.name < rhs.name;
+			});
+	return files;
+}
+
+}  /* img_view */
@@ -0,0 +1,39 @@
+/**
+ * dir_scanner.h
+ *
+ * List the files of a book in one pass, the directory is opened once and
+ * the files are looked up relative to it.
+ *
+ * Created by vamirio on 2022 Nov 12
+ */
+#ifndef DIR_SCANNER_H
+#define DIR_SCANNER_H
+
+#include <vector>
+
+#include <QString>
+
+#include "batch_io.h"
+
+namespace img_view {
+
+/* A file in a directory. */
+struct DirEntry {
+	QString path;  /* Absolute path. */
+	QString name;
+	FileStat stat;
+};
+
+/**
+ * @brief List the regular files in the directory DIR, the hidden files are
+ *        skipped.
+ *
+ * @param dir The absolute path of the directory
+ *
+ * @return The files sorted by name ascending, empty when DIR can't be read
+ */
+std::vector<DirEntry> scanDirectory(const QString& dir);
+
+}  /* img_view */
+
+#endif /* ifndef DIR_SCANNER_H */
@@ -0,0 +1,319 @@
+/**
+ * downscale.cc
+ *
+ * Created by vamirio on 2022 Sep 17
+ */
+#include "downscale.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DOWNSCALE_X86
+#endif
+
+#include "debug.h"
+
+namespace img_view {
+
+/* Row kernels, N is the number of bytes (channels) of the row. */
+struct Kernels {
+	const char* name;
+	/* ACC[i] += SRC[i]. */
+	void (*addRow16)(const uchar* src, std::uint16_t* acc, int n);
+	/* DST[i] = ((ACC[i] + ACC[i + 3] + ... + ACC[i + 3 * (KX - 1)] + HALF)
+	 *           * MUL) >> 16. */
+	void (*boxRow)(const std::uint16_t* acc, int kx, std::uint16_t half,
+			std::uint16_t mul, uchar* dst, int n);
+	/* ACC[i] += SRC[i] * WEIGHT. */
+	void (*addRowF)(const uchar* src, float weight, float* acc, int n);
+};
+
+static void addRow16Scalar(const uchar* src, std::uint16_t* acc, int n)
+{
+	for (int i = 0; i < n; ++i)
+		acc[i] += src[i];
+}
+
+static void boxRowScalar(const std::uint16_t* acc, int kx, std::uint16_t half,
+		std::uint16_t mul, uchar* dst, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		std::uint32_t sum = half;
+		for (int t = 0; t < kx; ++t)
+			sum += acc[i + 3 * t];
+		dst[i] = static_cast<uchar>(std::min<std::uint32_t>(
+					(sum * mul) >> 16, 255));
+	}
+}
+
+static void addRowFScalar(const uchar* src, float weight, float* acc, int n)
+{
+	for (int i = 0; i < n; ++i)
+		acc[i] += src[i] * weight;
+}
+
+#ifdef DOWNSCALE_X86
+__attribute__((target("sse4.1")))
+static void addRow16Sse41(const uchar* src, std::uint16_t* acc, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i* a = reinterpret_cast<__m128i*>(acc + i);
+		_mm_storeu_si128(a, _mm_add_epi16(_mm_loadu_si128(a),
+					_mm_cvtepu8_epi16(v)));
+		_mm_storeu_si128(a + 1, _mm_add_epi16(_mm_loadu_si128(a + 1),
+					_mm_cvtepu8_epi16(_mm_srli_si128(v, 8))));
+	}
+	addRow16Scalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void boxRowSse41(const std::uint16_t* acc, int kx, std::uint16_t half,
+		std::uint16_t mul, uchar* dst, int n)
+{
+	const __m128i h = _mm_set1_epi16(static_cast<short>(half));
+	const __m128i m = _mm_set1_epi16(static_cast<short>(mul));
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i sum = h;
+		for (int t = 0; t < kx; ++t) {
+			sum = _mm_add_epi16(sum, _mm_loadu_si128(
+						reinterpret_cast<const __m128i*>(acc + i + 3 * t)));
+		}
+		__m128i avg = _mm_mulhi_epu16(sum, m);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),
+				_mm_packus_epi16(avg, avg));
+	}
+	boxRowScalar(acc + i, kx, half, mul, dst + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void addRowFSse41(const uchar* src, float weight, float* acc, int n)
+{
+	const __m128 w = _mm_set1_ps(weight);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+		__m128 lo = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v));
+		__m128 hi = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+					_mm_mul_ps(lo, w)));
+		_mm_storeu_ps(acc + i + 4, _mm_add_ps(_mm_loadu_ps(acc + i + 4),
+					_mm_mul_ps(hi, w)));
+	}
+	addRowFScalar(src + i, weight, acc + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void addRow16Avx2(const uchar* src, std::uint16_t* acc, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+					reinterpret_cast<const __m128i*>(src + i)));
+		__m256i* a = reinterpret_cast<__m256i*>(acc + i);
+		_mm256_storeu_si256(a, _mm256_add_epi16(_mm256_loadu_si256(a), v));
+	}
+	addRow16Scalar(src + i, acc + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void boxRowAvx2(const std::uint16_t* acc, int kx, std::uint16_t half,
+		std::uint16_t mul, uchar* dst, int n)
+{
+	const __m256i h = _mm256_set1_epi16(static_cast<short>(half));
+	const __m256i m = _mm256_set1_epi16(static_cast<short>(mul));
+	int i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i sum = h;
+		for (int t = 0; t < kx; ++t) {
+			sum = _mm256_add_epi16(sum, _mm256_loadu_si256(
+						reinterpret_cast<const __m256i*>(acc + i + 3 * t)));
+		}
+		__m256i avg = _mm256_mulhi_epu16(sum, m);
+		/* Pack the two 128-bit lanes in order. */
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+				_mm_packus_epi16(_mm256_castsi256_si128(avg),
+					_mm256_extracti128_si256(avg, 1)));
+	}
+	boxRowScalar(acc + i, kx, half, mul, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void addRowFAvx2(const uchar* src, float weight, float* acc, int n)
+{
+	const __m256 w = _mm256_set1_ps(weight);
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(
+						reinterpret_cast<const __m128i*>(src + i))));
+		_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+					_mm256_mul_ps(v, w)));
+	}
+	addRowFScalar(src + i, weight, acc + i, n - i);
+}
+#endif /* DOWNSCALE_X86 */
+
+/* All the kernels the CPU supports, the best first. */
+static std::vector<Kernels> supportedKernels()
+{
+	std::vector<Kernels> ret;
+#ifdef DOWNSCALE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		ret.push_back({ "avx2", addRow16Avx2, boxRowAvx2, addRowFAvx2 });
+	if (__builtin_cpu_supports("sse4.1"))
+		ret.push_back({ "sse4.1", addRow16Sse41, boxRowSse41,
+				addRowFSse41 });
+#endif
+	ret.push_back({ "scalar", addRow16Scalar, boxRowScalar, addRowFScalar });
+	return ret;
+}
+
+static Kernels& kernels()
+{
+	static Kernels selected = [] {
+		Kernels k = supportedKernels().front();
+		gDebug() << "Downscale kernels:" << k.name;
+		return k;
+	}();
+	return selected;
+}
+
+bool setDownscaleKernels(const char* name)
+{
+	for (const Kernels& k : supportedKernels()) {
+		if (std::strcmp(k.name, name) == 0) {
+			kernels() = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Average KX * KY blocks of SRC. */
+static void downscaleBlock(const cv::Mat& src, cv::Mat& dst, int kx, int ky)
+{
+	const Kernels& k = kernels();
+	const int n = dst.cols * 3;
+	/* Channels of the source row used by the blocks, and the ones needed to
+	 * get the first channels of all blocks. */
+	const int used = n * kx;
+	const int span = used - 3 * (kx - 1);
+	const int count = kx * ky;
+	const std::uint16_t half = static_cast<std::uint16_t>(count / 2);
+	const std::uint16_t mul = static_cast<std::uint16_t>(65536 / count);
+
+	std::vector<std::uint16_t> acc(used);
+	std::vector<uchar> row(kx == 1 ? 0 : span);
+	for (int y = 0; y < dst.rows; ++y) {
+		std::fill(acc.begin(), acc.end(), 0);
+		for (int t = 0; t < ky; ++t)
+			k.addRow16(src.ptr<uchar>(y * ky + t), acc.data(), used);
+
+		uchar* out = dst.ptr<uchar>(y);
+		if (kx == 1) {
+			k.boxRow(acc.data(), 1, half, mul, out, n);
+			continue;
+		}
+		k.boxRow(acc.data(), kx, half, mul, row.data(), span);
+		for (int x = 0; x < dst.cols; ++x)
+			std::memcpy(out + 3 * x, row.data() + 3 * kx * x, 3);
+	}
+}
+
+/* Source pixels covered by the destination pixels along an axis. */
+struct AreaTaps {
+	/* Taps of the destination pixel i are [begin[i], begin[i + 1]). */
+	std::vector<int> begin;
+	std::vector<int> index;
+	std::vector<float> weight;
+};
+
+static AreaTaps areaTaps(int srcLen, int dstLen)
+{
+	AreaTaps taps;
+	const double scale = 1.0 * srcLen / dstLen;
+	for (int i = 0; i < dstLen; ++i) {
+		taps.begin.push_back(static_cast<int>(taps.index.size()));
+		double start = i * scale;
+		double end = std::min<double>((i + 1) * scale, srcLen);
+		for (int s = static_cast<int>(start); s < end; ++s) {
+			double weight = (std::min<double>(end, s + 1)
+					- std::max<double>(start, s)) / scale;
+			if (weight < 1e-6)
+				continue;
+			taps.index.push_back(s);
+			taps.weight.push_back(static_cast<float>(weight));
+		}
+	}
+	taps.begin.push_back(static_cast<int>(taps.index.size()));
+	return taps;
+}
+
+/* Average the covered areas with fractional weights. */
+static void downscaleAreaAny(const cv::Mat& src, cv::Mat& dst)
+{
+	const Kernels& k = kernels();
+	const AreaTaps xTaps = areaTaps(src.cols, dst.cols);
+	const AreaTaps yTaps = areaTaps(src.rows, dst.rows);
+
+	/* Sum the source rows first, then the columns of the sum. */
+	std::vector<float> acc(src.cols * 3);
+	for (int y = 0; y < dst.rows; ++y) {
+		std::fill(acc.begin(), acc.end(), 0.0f);
+		for (int t = yTaps.begin[y]; t < yTaps.begin[y + 1]; ++t) {
+			k.addRowF(src.ptr<uchar>(yTaps.index[t]), yTaps.weight[t],
+					acc.data(), src.cols * 3);
+		}
+
+		uchar* out = dst.ptr<uchar>(y);
+		for (int x = 0; x < dst.cols; ++x) {
+			float b = 0.0f, g = 0.0f, r = 0.0f;
+			for (int t = xTaps.begin[x]; t < xTaps.begin[x + 1]; ++t) {
+				const float* p = acc.data() + 3 * xTaps.index[t];
+				float w = xTaps.weight[t];
+				b += p[0] * w;
+				g += p[1] * w;
+				r += p[2] * w;
+			}
+			out[3 * x] = cv::saturate_cast<uchar>(b);
+			out[3 * x + 1] = cv::saturate_cast<uchar>(g);
+			out[3 * x + 2] = cv::saturate_cast<uchar>(r);
+		}
+	}
+}
+
+void downscaleArea(const cv::Mat& src, cv::Mat& dst, const cv::Size& size)
+{
+	if (src.type() != CV_8UC3 || src.empty() || size.width <= 0
+			|| size.height <= 0 || size.width > src.cols
+			|| size.height > src.rows) {
+		cv::resize(src, dst, size, 0, 0, cv::INTER_AREA);
+		return;
+	}
+	if (size == src.size()) {
+		dst = src.clone();
+		return;
+	}
+
+	/* Don't write into SRC when it is DST. */
+	cv::Mat ret(size, CV_8UC3);
+	int kx = src.cols / size.width;
+	int ky = src.rows / size.height;
+	/* The block sums must fit in 16 bits. */
+	if (src.cols == kx * size.width && src.rows == ky * size.height
+			&& kx * ky <= 256)
+		downscaleBlock(src, ret, kx, ky);
+	else
+		downscaleAreaAny(src, ret);
+	dst = ret;
+}
+
+}  /* img_view */
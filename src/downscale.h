@@ -0,0 +1,42 @@
+/**
+ * downscale.h
+ *
+ * Area average downscaling of BGR888 images, the row kernels are vectorized
+ * with SSE4.1 or AVX2, which one is used is decided by the CPU at runtime.
+ *
+ * Created by vamirio on 2022 Sep 17
+ */
+#ifndef DOWNSCALE_H
+#define DOWNSCALE_H
+
+#include <opencv2/opencv.hpp>
+
+namespace img_view {
+
+/**
+ * @brief Shrink SRC to SIZE, every destination pixel is the average of the
+ *        source area it covers, the same as cv::resize() with cv::INTER_AREA.
+ *
+ * When the size is divided exactly by SIZE, the pixels are averaged in
+ * integer blocks, which is the case of building the mipmap levels.
+ *
+ * @param src The source image, other types than CV_8UC3 or enlarging in any
+ *        direction are passed to cv::resize()
+ * @param dst The destination image, it may be SRC
+ * @param size The destination size
+ */
+void downscaleArea(const cv::Mat& src, cv::Mat& dst, const cv::Size& size);
+
+/**
+ * @brief Use the row kernels NAME ("scalar", "sse4.1" or "avx2") instead of
+ *        the best ones for the CPU, for the tests and the benchmark. It is
+ *        not thread safe, call it before any downscaling.
+ *
+ * @return False when NAME is unknown or not supported by the CPU, the kernels
+ *         are unchanged then
+ */
+bool setDownscaleKernels(const char* name);
+
+}  /* img_view */
+
+#endif /* ifndef DOWNSCALE_H */
@@ -0,0 +1,307 @@
+/**
+ * frame_reader.cc
+ *
+ * Created by vamirio on 2022 Oct 01
+ */
+#include "frame_reader.h"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <QImageReader>
+#include <QPainter>
+
+#include "image_info.h"
+
+namespace img_view {
+
+/* Read GIF and WebP animations by Qt. */
+class QtFrameReader : public FrameReader {
+public:
+	explicit QtFrameReader(std::unique_ptr<QIODevice> dev)
+		: _dev(std::move(dev)), _reader(_dev.get()) {}
+
+	bool valid() const { return _reader.canRead(); }
+
+	bool read(QImage* frame, int* delay) override
+	{
+		if (!_reader.canRead())
+			return false;
+		*frame = _reader.read();
+		*delay = _reader.nextImageDelay();
+		return !frame->isNull();
+	}
+
+	bool rewind() override
+	{
+		if (_reader.jumpToImage(0))
+			return true;
+		if (!_dev->seek(0))
+			return false;
+		_reader.setDevice(_dev.get());
+		return _reader.canRead();
+	}
+
+	int loopCount() const override { return _reader.loopCount(); }
+
+private:
+	std::unique_ptr<QIODevice> _dev;
+	QImageReader _reader;
+};
+
+/*
+ * Read APNG animations, every frame is rebuilt into a standalone PNG image
+ * with the shared chunks, decoded by Qt, then composited onto the canvas.
+ */
+class ApngFrameReader : public FrameReader {
+public:
+	/**
+	 * @brief Load the image from DEV and index its frames.
+	 *
+	 * @return False if it is not an APNG image
+	 */
+	bool open(QIODevice* dev);
+
+	bool read(QImage* frame, int* delay) override;
+
+	bool rewind() override
+	{
+		_next = 0;
+		return true;
+	}
+
+	int loopCount() const override { return _plays == 0 ? -1 : _plays - 1; }
+
+private:
+	struct Frame {
+		QRect rect;
+		int delay = 0;
+		int dispose = 0;  /* 0: none, 1: background, 2: previous. */
+		int blend = 0;    /* 0: source, 1: over. */
+		/* Offsets and lengths of the compressed data in the file. */
+		std::vector<std::pair<qsizetype, qsizetype>> parts;
+	};
+
+	/**
+	 * @brief Build a PNG image with the data of FRAME.
+	 */
+	QByteArray buildPng(const Frame& frame) const;
+
+	/**
+	 * @brief Append a chunk of TYPE and DATA to PNG.
+	 */
+	static void appendChunk(QByteArray* png, const char* type,
+			const QByteArray& data);
+
+private:
+	QByteArray _data;
+	QByteArray _ihdr;
+	/* Chunks other than IHDR before the first IDAT, e.g. PLTE and tRNS. */
+	QByteArray _shared;
+	std::vector<Frame> _frames;
+	quint32 _plays = 0;
+
+	std::size_t _next = 0;
+	QImage _canvas;
+	/* The canvas area under the previous frame before it was drawn. */
+	QImage _saved;
+};
+
+static const char kPngSignature[] = "\x89PNG\r\n\x1A\n";
+
+static quint32 be32(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return (quint32(u[0]) << 24) | (quint32(u[1]) << 16)
+		| (quint32(u[2]) << 8) | u[3];
+}
+
+static quint16 be16(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return static_cast<quint16>((u[0] << 8) | u[1]);
+}
+
+static void putBe32(char* p, quint32 v)
+{
+	p[0] = static_cast<char>(v >> 24);
+	p[1] = static_cast<char>(v >> 16);
+	p[2] = static_cast<char>(v >> 8);
+	p[3] = static_cast<char>(v);
+}
+
+/* CRC-32 used by the PNG chunks. */
+static quint32 crc32(quint32 crc, const char* data, qsizetype len)
+{
+	static const std::vector<quint32> kTable = [] {
+		std::vector<quint32> table(256);
+		for (quint32 i = 0; i < 256; ++i) {
+			quint32 c = i;
+			for (int k = 0; k < 8; ++k)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+		return table;
+	}();
+
+	crc = ~crc;
+	for (qsizetype i = 0; i < len; ++i)
+		crc = kTable[(crc ^ static_cast<uchar>(data[i])) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+bool ApngFrameReader::open(QIODevice* dev)
+{
+	_data = dev->readAll();
+
+	const char* data = _data.constData();
+	qsizetype len = _data.size();
+	if (len < 8 || memcmp(data, kPngSignature, 8) != 0)
+		return false;
+
+	bool animated = false;
+	bool idat = false;
+	QSize canvas;
+	for (qsizetype pos = 8; pos + 12 <= len; ) {
+		qsizetype size = be32(data + pos);
+		const char* type = data + pos + 4;
+		const char* payload = data + pos + 8;
+		if (size > len - pos - 12)
+			break;
+
+		if (memcmp(type, "IHDR", 4) == 0 && size == 13) {
+			_ihdr = QByteArray(payload, size);
+			canvas = QSize(be32(payload), be32(payload + 4));
+		} else if (memcmp(type, "acTL", 4) == 0 && size == 8) {
+			animated = true;
+			_plays = be32(payload + 4);
+		} else if (memcmp(type, "fcTL", 4) == 0 && size == 26) {
+			Frame frame;
+			frame.rect = QRect(be32(payload + 12), be32(payload + 16),
+					be32(payload + 4), be32(payload + 8));
+			int num = be16(payload + 20);
+			int den = be16(payload + 22);
+			frame.delay = num * 1000 / (den == 0 ? 100 : den);
+			frame.dispose = static_cast<uchar>(payload[24]);
+			frame.blend = static_cast<uchar>(payload[25]);
+			if (!QRect(QPoint(0, 0), canvas).contains(frame.rect)
+					|| frame.rect.isEmpty())
+				return false;
+			_frames.push_back(frame);
+		} else if (memcmp(type, "IDAT", 4) == 0) {
+			idat = true;
+			/* The default image is the first frame only when a fcTL
+			 * precedes it. */
+			if (_frames.size() == 1)
+				_frames.back().parts.emplace_back(pos + 8, size);
+		} else if (memcmp(type, "fdAT", 4) == 0 && size > 4) {
+			/* Skip the sequence number. */
+			if (!_frames.empty())
+				_frames.back().parts.emplace_back(pos + 12, size - 4);
+		} else if (memcmp(type, "IEND", 4) == 0) {
+			break;
+		} else if (!idat) {
+			_shared.append(data + pos, size + 12);
+		}
+		pos += size + 12;
+	}
+
+	/* Drop the frames without data, e.g. the truncated ones. */
+	while (!_frames.empty() && _frames.back().parts.empty())
+		_frames.pop_back();
+	return animated && !_ihdr.isEmpty() && !_frames.empty()
+		&& _frames.front().rect.size() == canvas;
+}
+
+bool ApngFrameReader::read(QImage* frame, int* delay)
+{
+	if (_next >= _frames.size())
+		return false;
+
+	const Frame& cur = _frames[_next];
+	if (_next == 0) {
+		QSize canvas(be32(_ihdr.constData()), be32(_ihdr.constData() + 4));
+		_canvas = QImage(canvas, QImage::Format_ARGB32_Premultiplied);
+		_canvas.fill(Qt::transparent);
+	} else {
+		/* Dispose the previous frame. */
+		const Frame& prev = _frames[_next - 1];
+		QPainter painter(&_canvas);
+		painter.setCompositionMode(QPainter::CompositionMode_Source);
+		if (prev.dispose == 1 || (prev.dispose == 2 && _next == 1))
+			painter.fillRect(prev.rect, Qt::transparent);
+		else if (prev.dispose == 2)
+			painter.drawImage(prev.rect.topLeft(), _saved);
+	}
+
+	QImage image = QImage::fromData(buildPng(cur), "PNG");
+	if (image.isNull())
+		return false;
+	if (cur.dispose == 2)
+		_saved = _canvas.copy(cur.rect);
+
+	QPainter painter(&_canvas);
+	painter.setCompositionMode(cur.blend == 0
+			? QPainter::CompositionMode_Source
+			: QPainter::CompositionMode_SourceOver);
+	painter.drawImage(cur.rect.topLeft(), image);
+	painter.end();
+
+	*frame = _canvas;
+	*delay = cur.delay;
+	++_next;
+	return true;
+}
+
+QByteArray ApngFrameReader::buildPng(const Frame& frame) const
+{
+	QByteArray png(kPngSignature, 8);
+
+	QByteArray ihdr = _ihdr;
+	putBe32(ihdr.data(), frame.rect.width());
+	putBe32(ihdr.data() + 4, frame.rect.height());
+	appendChunk(&png, "IHDR", ihdr);
+	png += _shared;
+
+	QByteArray idat;
+	for (const auto& [offset, len] : frame.parts)
+		idat.append(_data.constData() + offset, len);
+	appendChunk(&png, "IDAT", idat);
+	appendChunk(&png, "IEND", QByteArray());
+	return png;
+}
+
+void ApngFrameReader::appendChunk(QByteArray* png, const char* type,
+		const QByteArray& data)
+{
+	char buf[4];
+	putBe32(buf, data.size());
+	png->append(buf, 4);
+	qsizetype start = png->size();
+	png->append(type, 4);
+	png->append(data);
+	putBe32(buf, crc32(0, png->constData() + start, 4 + data.size()));
+	png->append(buf, 4);
+}
+
+std::unique_ptr<FrameReader> createFrameReader(const ImageInfo& info)
+{
+	std::unique_ptr<QIODevice> dev = info.open();
+	if (!dev)
+		return nullptr;
+
+	if (info.format() == ImageFormat::png) {
+		auto apng = std::make_unique<ApngFrameReader>();
+		if (apng->open(dev.get()))
+			return apng;
+		dev->seek(0);
+	}
+
+	auto reader = std::make_unique<QtFrameReader>(std::move(dev));
+	if (!reader->valid())
+		return nullptr;
+	return reader;
+}
+
+}  /* img_view */
@@ -0,0 +1,57 @@
+/**
+ * frame_reader.h
+ *
+ * Read the frames of animated images one by one.
+ *
+ * Created by vamirio on 2022 Oct 01
+ */
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include <memory>
+
+#include <QImage>
+
+namespace img_view {
+
+class ImageInfo;
+
+class FrameReader {
+public:
+	virtual ~FrameReader() = default;
+
+	/**
+	 * @brief Read the next frame.
+	 *
+	 * @param frame Where to store the frame, it is the full canvas
+	 * @param delay Where to store the time to show the frame in milliseconds
+	 *
+	 * @return False when there is no more frame or failed
+	 */
+	virtual bool read(QImage* frame, int* delay) = 0;
+
+	/**
+	 * @brief Go back to the first frame.
+	 *
+	 * @return True when succeeded
+	 */
+	virtual bool rewind() = 0;
+
+	/**
+	 * @brief Get the number of times the animation is repeated after the
+	 *        first play, -1 for forever.
+	 */
+	virtual int loopCount() const = 0;
+};
+
+/**
+ * @brief Create a reader for the animated image INFO, APNG images are read by
+ *        our own reader, the others by QImageReader.
+ *
+ * @return The reader, or nullptr when the image can't be read
+ */
+std::unique_ptr<FrameReader> createFrameReader(const ImageInfo& info);
+
+}  /* img_view */
+
+#endif /* ifndef FRAME_READER_H */
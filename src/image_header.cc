@@ -0,0 +1,296 @@
+/**
+ * image_header.cc
+ *
+ * Created by vamirio on 2022 Aug 20
+ */
+#include "image_header.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace img_view {
+
+/* Read unsigned integers in little endian and big endian. */
+static quint32 le16(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return u[0] | (u[1] << 8);
+}
+
+static quint32 le24(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return u[0] | (u[1] << 8) | (u[2] << 16);
+}
+
+static quint32 le32(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return u[0] | (u[1] << 8) | (u[2] << 16) | (quint32(u[3]) << 24);
+}
+
+static quint32 be16(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return (u[0] << 8) | u[1];
+}
+
+static quint32 be32(const char* p)
+{
+	const uchar* u = reinterpret_cast<const uchar*>(p);
+	return (quint32(u[0]) << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+bool readImageHeader(const char* data, qint64 len, const ImageFormat& format,
+		ImageHeader* header)
+{
+	switch (format) {
+	case ImageFormat::bmp:
+		return readBmpHeader(data, len, header);
+	case ImageFormat::gif:
+		return readGifHeader(data, len, header);
+	case ImageFormat::jpeg:
+		return readJpegHeader(data, len, header);
+	case ImageFormat::png:
+		return readPngHeader(data, len, header);
+	case ImageFormat::webp:
+		return readWebpHeader(data, len, header);
+	default:
+		return false;
+	}
+}
+
+bool readBmpHeader(const char* data, qint64 len, ImageHeader* header)
+{
+	/* File header (14 bytes) + the size of the DIB header. */
+	if (len < 18 || memcmp(data, "BM", 2) != 0)
+		return false;
+
+	quint32 dib_size = le32(data + 14);
+	if (dib_size == 12) {  /* BITMAPCOREHEADER. */
+		if (len < 26)
+			return false;
+		header->width = le16(data + 18);
+		header->height = le16(data + 20);
+		header->depth = le16(data + 24);
+		return true;
+	}
+	if (dib_size < 40 || len < 30)
+		return false;
+
+	/* The height is negative for a top-down bitmap. */
+	qint32 width = static_cast<qint32>(le32(data + 18));
+	qint32 height = static_cast<qint32>(le32(data + 22));
+	if (width <= 0 || height == 0)
+		return false;
+	header->width = width;
+	header->height = height < 0 ? -height : height;
+	header->depth = le16(data + 28);
+	return true;
+}
+
+bool readGifHeader(const char* data, qint64 len, ImageHeader* header)
+{
+	/* Signature (6 bytes) + logical screen descriptor (7 bytes). */
+	if (len < 13 || (memcmp(data, "GIF87a", 6) != 0
+				&& memcmp(data, "GIF89a", 6) != 0))
+		return false;
+
+	header->width = le16(data + 6);
+	header->height = le16(data + 8);
+	/* The size of the global color table decides the bits per pixel. */
+	uchar packed = static_cast<uchar>(data[10]);
+	header->depth = (packed & 0x80) ? (packed & 0x07) + 1 : 8;
+	return header->width > 0 && header->height > 0;
+}
+
+/**
+ * @brief Get the orientation in the EXIF data of a jpeg image.
+ *
+ * @param data The payload of the APP1 segment
+ * @param len Length of DATA in bytes
+ *
+ * @return The orientation (1 ~ 8), or 1 (upright) when there is none
+ */
+static int readExifOrientation(const char* data, qint64 len)
+{
+	/* "Exif\0\0" + TIFF header: byte order (2) + 42 (2) + IFD0 offset (4). */
+	if (len < 14 || memcmp(data, "Exif\0\0", 6) != 0)
+		return 1;
+	const char* tiff = data + 6;
+	qint64 tiff_len = len - 6;
+	bool le = memcmp(tiff, "II", 2) == 0;
+	if (!le && memcmp(tiff, "MM", 2) != 0)
+		return 1;
+	auto u16 = [le](const char* p) { return le ? le16(p) : be16(p); };
+	auto u32 = [le](const char* p) { return le ? le32(p) : be32(p); };
+
+	/* IFD0: count (2) + entries of tag (2) + type (2) + count (4) +
+	 * value (4). */
+	qint64 ifd = u32(tiff + 4);
+	if (ifd < 8 || ifd + 2 > tiff_len)
+		return 1;
+	qint64 count = u16(tiff + ifd);
+	for (qint64 i = 0; i != count; ++i) {
+		const char* entry = tiff + ifd + 2 + i * 12;
+		if (entry + 12 > tiff + tiff_len)
+			break;
+		if (u16(entry) == 0x0112) {  /* Orientation, a SHORT. */
+			int orientation = static_cast<int>(u16(entry + 8));
+			return orientation >= 1 && orientation <= 8 ? orientation : 1;
+		}
+	}
+	return 1;
+}
+
+bool readJpegHeader(const char* data, qint64 len, ImageHeader* header)
+{
+	if (len < 4 || memcmp(data, "\xFF\xD8", 2) != 0)
+		return false;
+
+	int orientation = 1;
+	qint64 pos = 2;
+	while (pos + 4 <= len) {
+		if (static_cast<uchar>(data[pos]) != 0xFF)
+			return false;
+		/* Any number of fill bytes (0xFF) may precede a marker. */
+		uchar marker = static_cast<uchar>(data[++pos]);
+		while (marker == 0xFF && pos + 1 < len)
+			marker = static_cast<uchar>(data[++pos]);
+		++pos;
+
+		/* Standalone markers without a length field. */
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8))
+			continue;
+		/* Reach the image data or the end before any frame header. */
+		if (marker == 0xD9 || marker == 0xDA)
+			return false;
+
+		if (pos + 2 > len)
+			return false;
+		qint64 seg_len = be16(data + pos);
+		if (seg_len < 2)
+			return false;
+
+		/* APP1, the EXIF orientation is applied by the decoders. */
+		if (marker == 0xE1) {
+			orientation = readExifOrientation(data + pos + 2,
+					std::min(seg_len, len - pos) - 2);
+		}
+
+		/* SOF0 ~ SOF15, except DHT (C4), JPG (C8) and DAC (CC). */
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4
+				&& marker != 0xC8 && marker != 0xCC) {
+			/* Length (2) + precision (1) + height (2) + width (2) +
+			 * components (1). */
+			if (pos + 8 > len)
+				return false;
+			int precision = static_cast<uchar>(data[pos + 2]);
+			header->height = be16(data + pos + 3);
+			header->width = be16(data + pos + 5);
+			header->depth = precision * static_cast<uchar>(data[pos + 7]);
+			/* Orientations 5 ~ 8 rotate the image by 90 degrees. */
+			if (orientation >= 5)
+				std::swap(header->width, header->height);
+			return header->width > 0 && header->height > 0;
+		}
+		pos += seg_len;
+	}
+	return false;
+}
+
+bool readPngHeader(const char* data, qint64 len, ImageHeader* header)
+{
+	/* Signature (8 bytes) + IHDR chunk length (4) + type (4) + width (4) +
+	 * height (4) + bit depth (1) + color type (1). */
+	if (len < 26 || memcmp(data, "\x89PNG\r\n\x1A\n", 8) != 0
+			|| memcmp(data + 12, "IHDR", 4) != 0)
+		return false;
+
+	int channels = 0;
+	switch (data[25]) {
+	case 0:  /* Grayscale. */
+	case 3:  /* Indexed-color. */
+		channels = 1;
+		break;
+	case 2:  /* Truecolor. */
+		channels = 3;
+		break;
+	case 4:  /* Grayscale with alpha. */
+		channels = 2;
+		break;
+	case 6:  /* Truecolor with alpha. */
+		channels = 4;
+		break;
+	default:
+		return false;
+	}
+
+	header->width = static_cast<int>(be32(data + 16));
+	header->height = static_cast<int>(be32(data + 20));
+	header->depth = static_cast<uchar>(data[24]) * channels;
+	if (header->width <= 0 || header->height <= 0)
+		return false;
+
+	/* The acTL chunk must precede the first IDAT chunk, every chunk is
+	 * length (4) + type (4) + data + CRC (4). */
+	header->animated = false;
+	for (qint64 pos = 8; pos + 8 <= len; ) {
+		const char* type = data + pos + 4;
+		if (memcmp(type, "IDAT", 4) == 0)
+			return true;
+		if (memcmp(type, "acTL", 4) == 0) {
+			/* Number of frames (4) + number of plays (4). */
+			if (pos + 12 > len)
+				return false;
+			header->animated = be32(data + pos + 8) > 1;
+			return true;
+		}
+		pos += 12 + static_cast<qint64>(be32(data + pos));
+	}
+	return false;
+}
+
+bool readWebpHeader(const char* data, qint64 len, ImageHeader* header)
+{
+	/* "RIFF" + file size (4) + "WEBP" + chunk type (4) + chunk size (4). */
+	if (len < 20 || memcmp(data, "RIFF", 4) != 0
+			|| memcmp(data + 8, "WEBP", 4) != 0)
+		return false;
+
+	const char* chunk = data + 12;
+	const char* payload = data + 20;
+	header->animated = false;
+	if (memcmp(chunk, "VP8 ", 4) == 0) {
+		/* Frame tag (3) + start code (3) + width (2) + height (2). */
+		if (len < 30 || memcmp(payload + 3, "\x9D\x01\x2A", 3) != 0)
+			return false;
+		header->width = le16(payload + 6) & 0x3FFF;
+		header->height = le16(payload + 8) & 0x3FFF;
+		header->depth = 24;
+	} else if (memcmp(chunk, "VP8L", 4) == 0) {
+		/* Signature (1) + 14 bits width - 1 + 14 bits height - 1 + 1 bit
+		 * alpha. */
+		if (len < 25 || static_cast<uchar>(payload[0]) != 0x2F)
+			return false;
+		quint32 bits = le32(payload + 1);
+		header->width = (bits & 0x3FFF) + 1;
+		header->height = ((bits >> 14) & 0x3FFF) + 1;
+		header->depth = (bits >> 28) & 0x1 ? 32 : 24;
+	} else if (memcmp(chunk, "VP8X", 4) == 0) {
+		/* Flags (1) + reserved (3) + 24 bits canvas width - 1 + 24 bits
+		 * canvas height - 1. */
+		if (len < 30)
+			return false;
+		header->width = le24(payload + 4) + 1;
+		header->height = le24(payload + 7) + 1;
+		header->depth = payload[0] & 0x10 ? 32 : 24;
+		header->animated = payload[0] & 0x02;
+	} else {
+		return false;
+	}
+	return header->width > 0 && header->height > 0;
+}
+
+}  /* img_view */
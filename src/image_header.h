@@ -0,0 +1,81 @@
+/**
+ * image_header.h
+ *
+ * Parse image file headers to get the image information without decoding the
+ * pixels.
+ *
+ * Created by vamirio on 2022 Aug 20
+ */
+#ifndef IMAGE_HEADER_H
+#define IMAGE_HEADER_H
+
+#include <QtGlobal>
+
+#include "image_info.h"
+
+namespace img_view {
+
+struct ImageHeader {
+	int width = 0;   /* Width in pixels. */
+	int height = 0;  /* Height in pixels. */
+	int depth = 0;   /* Bits per pixel stored in the file. */
+	bool animated = false;  /* Animated webp or png (APNG). */
+};
+
+/**
+ * @brief Parse the header of an image whose format is FORMAT.
+ *
+ * @param data The beginning of the image file
+ * @param len Length of DATA in bytes
+ * @param format The image format
+ * @param header Where to store the result, its content is undefined when
+ *               failed
+ *
+ * @return True when succeeded, false when the header is malformed, the format
+ *         is unknown, or the header is not fully contained in DATA (read more
+ *         data and try again then)
+ */
+bool readImageHeader(const char* data, qint64 len, const ImageFormat& format,
+		ImageHeader* header);
+
+/**
+ * @brief Parse the header of a bmp image, see readImageHeader().
+ */
+bool readBmpHeader(const char* data, qint64 len, ImageHeader* header);
+
+/**
+ * @brief Parse the header of a gif image, see readImageHeader().
+ */
+bool readGifHeader(const char* data, qint64 len, ImageHeader* header);
+
+/**
+ * @brief Parse the header of a jpeg image, see readImageHeader().
+ *
+ * The segments before the SOFn (start of frame) marker are skipped, so DATA
+ * may need to contain the EXIF thumbnail and the ICC profile.
+ *
+ * The width and the height are swapped when the EXIF orientation rotates the
+ * image by 90 degrees, so they match the image decoded.
+ */
+bool readJpegHeader(const char* data, qint64 len, ImageHeader* header);
+
+/**
+ * @brief Parse the header of a png image, see readImageHeader().
+ *
+ * The chunks before the first IDAT chunk are scanned for the acTL chunk of
+ * APNG, so DATA may need to contain the ICC profile and the text chunks.
+ */
+bool readPngHeader(const char* data, qint64 len, ImageHeader* header);
+
+/**
+ * @brief Parse the header of a webp image (VP8, VP8L or VP8X),
+ *        see readImageHeader().
+ *
+ * Only the extended format (VP8X) may be animated, it is told by the
+ * animation flag.
+ */
+bool readWebpHeader(const char* data, qint64 len, ImageHeader* header);
+
+}  /* img_view */
+
+#endif /* ifndef IMAGE_HEADER_H */
@@ -5,28 +5,43 @@
  */
 #include "image_info.h"
 
+#include <algorithm>
+
 #include <QFileInfo>
 #include <QImage>
-#include <QVector>
 #include <QMap>
 #include <opencv2/opencv.hpp>
 
 #include "debug.h"
+#include "image_header.h"
+#include "mapped_file.h"
+#include "zip_archive.h"
 
 namespace img_view {
 
-/* kFormat and kCheckFormat hould have the same order. */
-const QVector<ImageFormat> kFormat {
-	ImageFormat::bmp,
-	ImageFormat::gif,
-	ImageFormat::jpeg,
-	ImageFormat::png,
-	ImageFormat::webp
+/* Magic numbers of the supported formats, a zero byte in the mask means the
+ * byte at the same offset can be anything. */
+struct FormatSignature {
+	ImageFormat format;
+	qint64 len;
+	const char* magic;
+	const char* mask;
 };
-const QVector<bool (*)(QDataStream&)> kCheckFormat {
-	isBmp, isGif, isJpeg, isPng, isWebp
+
+const FormatSignature kSignature[] {
+	{ ImageFormat::bmp, 2, "BM", nullptr },
+	{ ImageFormat::gif, 4, "GIF8", nullptr },
+	{ ImageFormat::jpeg, 2, "\xFF\xD8", nullptr },
+	{ ImageFormat::png, 8, "\x89PNG\r\n\x1A\n", nullptr },
+	{ ImageFormat::webp, 12, "RIFF\0\0\0\0WEBP",
+		"\xFF\xFF\xFF\xFF\0\0\0\0\xFF\xFF\xFF\xFF" }
 };
 
+/* The number of bytes read to parse the image header, read more when the
+ * header is not fully contained in it, e.g. a jpeg with a large EXIF
+ * thumbnail before its SOFn segment. */
+const qint64 kProbeSize[] { kHeadSize, 64 * 1024, 1024 * 1024 };
+
 const QMap<ImageFormat, const char* > kFormatStr {
 	{ ImageFormat::unknown, "unknown" },
 	{ ImageFormat::bmp, "bmp"},
@@ -37,50 +52,72 @@ const QMap<ImageFormat, const char* > kFormatStr {
 };
 
 /**
- * @brief Compare LEN bytes raw data between DATA that offsets OFFSET bytes
- *        from the beginning and BUF
- *
- * NOTE: this function will change the data stream status, you should save the
- * status yourself if you want to use it after calling this function.
- *
- * @return True when they are same
+ * @brief Check if the first LEN bytes of DATA match the signature SIG.
  */
-bool compare(QDataStream& data, const qint64& offset,
-		const qint64& len, const char* const buf);
-
-bool compare(QDataStream& data, const qint64& offset,
-		const qint64& len, const char* const buf)
+static bool match(const char* data, const qint64& len,
+		const FormatSignature& sig)
 {
-	data.device()->seek(offset);
+	if (len < sig.len)
+		return false;
+	for (qint64 i = 0; i != sig.len; ++i) {
+		char mask = sig.mask ? sig.mask[i] : '\xFF';
+		if ((data[i] & mask) != (sig.magic[i] & mask))
+			return false;
+	}
+	return true;
+}
 
-	char* magic = new char[len];
-	bool res = data.readRawData(magic, len) != -1
-		&& memcmp(magic, buf, len) == 0;
-	delete[] magic;
+/**
+ * @brief Read the first kSniffSize bytes of the file FILEPATH into BUF.
+ *
+ * @return The number of bytes read, -1 when failed
+ */
+static qint64 readPrefix(const QString& filepath, char* buf)
+{
+	QFile img(filepath);
+	if (!img.open(QIODevice::ReadOnly))
+		return -1;
+	return img.read(buf, kSniffSize);
+}
 
-	return res;
+/**
+ * @brief Read the first kSniffSize bytes of the data stream DATA into BUF,
+ *        the stream position is restored.
+ *
+ * @return The number of bytes read, -1 when failed
+ */
+static qint64 readPrefix(QDataStream& data, char* buf)
+{
+	QIODevice* dev = data.device();
+	qint64 pos = dev->pos();
+	if (!dev->seek(0))
+		return -1;
+	qint64 len = dev->read(buf, kSniffSize);
+	dev->seek(pos);
+	return len;
 }
 
 ImageFormat getImageFormat(const QString& filepath)
 {
-	QFile img(filepath);
-	img.open(QIODevice::ReadOnly);
-	QDataStream data(&img);
-	ImageFormat format = getImgFormat(data);
-	img.close();
-
-	return format;
+	char buf[kSniffSize];
+	return getImageFormat(buf, readPrefix(filepath, buf));
 }
 
-ImageFormat getImgFormat(QDataStream& data)
+ImageFormat getImageFormat(const char* data, const qint64& len)
 {
-	for (int i = 0; i != kCheckFormat.size(); ++i) {
-		if (kCheckFormat[i](data))
-			return kFormat[i];
+	for (const FormatSignature& sig : kSignature) {
+		if (match(data, len, sig))
+			return sig.format;
 	}
 	return ImageFormat::unknown;
 }
 
+ImageFormat getImgFormat(QDataStream& data)
+{
+	char buf[kSniffSize];
+	return getImageFormat(buf, readPrefix(data, buf));
+}
+
 const char* imageFormatToStr(const ImageFormat& format)
 {
 	return kFormatStr[format];
@@ -88,107 +125,52 @@ const char* imageFormatToStr(const ImageFormat& format)
 
 bool isBmp(const QString& image)
 {
-	QFile img(image);
-	if (!img.open(QIODevice::ReadOnly))
-		return false;
-	QDataStream data(&img);
-	bool ret = compare(data, 0, 2, "\x42\x4D");
-	img.close();
-
-	return ret;
+	return getImageFormat(image) == ImageFormat::bmp;
 }
 
 bool isBmp(QDataStream& data)
 {
-	qint64 pos = data.device()->pos();
-	bool ret = compare(data, 0, 2, "\x42\x4D");
-	data.device()->seek(pos);
-
-	return ret;
+	return getImgFormat(data) == ImageFormat::bmp;
 }
 
 bool isGif(const QString& image)
 {
-	QFile img(image);
-	if (!img.open(QIODevice::ReadOnly))
-		return false;
-	QDataStream data(&img);
-	bool ret = compare(data, 0, 4, "\x47\x49\x46\x38");
-	img.close();
-
-	return ret;
+	return getImageFormat(image) == ImageFormat::gif;
 }
 
 bool isGif(QDataStream& data)
 {
-	qint64 pos = data.device()->pos();
-	bool ret = compare(data, 0, 4, "\x47\x49\x46\x38");
-	data.device()->seek(pos);
-
-	return ret;
+	return getImgFormat(data) == ImageFormat::gif;
 }
 
 bool isJpeg(const QString& image)
 {
-	QFile img(image);
-	if (!img.open(QIODevice::ReadOnly))
-		return false;
-	QDataStream data(&img);
-	bool ret = compare(data, 0, 2, "\xFF\xD8");
-	img.close();
-
-	return ret;
+	return getImageFormat(image) == ImageFormat::jpeg;
 }
 
 bool isJpeg(QDataStream& data)
 {
-	qint64 pos = data.device()->pos();
-	bool ret = compare(data, 0, 2, "\xFF\xD8");
-	data.device()->seek(pos);
-
-	return ret;
+	return getImgFormat(data) == ImageFormat::jpeg;
 }
 
 bool isPng(const QString& image)
 {
-	QFile img(image);
-	img.open(QIODevice::ReadOnly);
-	QDataStream data(&img);
-	bool ret = compare(data, 0, 8, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A");
-	img.close();
-
-	return ret;
+	return getImageFormat(image) == ImageFormat::png;
 }
 
 bool isPng(QDataStream& data)
 {
-	qint64 pos = data.device()->pos();
-	bool ret = compare(data, 0, 8, "\x89\x50\x4E\x47\x0D\x0A\x1A\x0A");
-	data.device()->seek(pos);
-
-	return ret;
+	return getImgFormat(data) == ImageFormat::png;
 }
 
 bool isWebp(const QString& image)
 {
-	QFile img(image);
-	img.open(QIODevice::ReadOnly);
-	QDataStream data(&img);
-	bool ret = compare(data, 0, 4, "\x52\x49\x46\x46")
-		&& compare(data, 8, 4, "\x57\x45\x42\x50");
-	img.close();
-
-	return ret;
+	return getImageFormat(image) == ImageFormat::webp;
 }
 
 bool isWebp(QDataStream& data)
 {
-	qint64 pos = data.device()->pos();
-	bool ret = compare(data, 0, 4, "\x52\x49\x46\x46")
-		&& compare(data, 8, 4, "\x57\x45\x42\x50");
-	data.device()->seek(pos);
-
-	return ret;
+	return getImgFormat(data) == ImageFormat::webp;
 }
 
 ImageInfo::ImageInfo()
@@ -198,62 +180,62 @@ ImageInfo::ImageInfo()
 
 ImageInfo::ImageInfo(const ImageInfo& rhs) : _size(rhs._size),
 	_lastModified(rhs._lastModified), _format(rhs._format),
-	_width(rhs._width), _height(rhs._height), _depth(rhs._depth)
+	_width(rhs._width), _height(rhs._height), _depth(rhs._depth),
+	_animated(rhs._animated)
 {
-	_path = new char[strlen(rhs._path) + 1];
-	strcpy(_path, rhs._path);
-	_filename = _path + strlen(_path) - strlen(rhs._filename);
-	_extension = _path + strlen(_path) - strlen(rhs._extension);
+	copyPath(rhs);
 }
 
-ImageInfo ImageInfo::operator=(const ImageInfo& rhs)
+ImageInfo& ImageInfo::operator=(const ImageInfo& rhs)
 {
 	if (this == &rhs)
 		return *this;
 
 	if (_path) {
 		delete[] _path;
-		_path = _filename = _extension = nullptr;
+		_path = _filename = _extension = _member = nullptr;
 	}
-	_path = new char[strlen(rhs._path) + 1];
-	strcpy(_path, rhs._path);
-	_filename = _path + strlen(_path) - strlen(rhs._filename);
-	_extension = _path + strlen(_path) - strlen(rhs._extension);
+	copyPath(rhs);
 	_size = rhs._size;
 	_lastModified = rhs._lastModified;
 	_format = rhs._format;
 	_width = rhs._width;
 	_height = rhs._height;
 	_depth = rhs._depth;
+	_animated = rhs._animated;
 
 	return *this;
 }
 
 ImageInfo::ImageInfo(ImageInfo&& rhs) noexcept : _path(rhs._path),
 	_filename(rhs._filename), _extension(rhs._extension),
-	_size(rhs._size), _lastModified(rhs._lastModified),
+	_member(rhs._member), _size(rhs._size), _lastModified(rhs._lastModified),
 	_format(rhs._format), _width(rhs._width), _height(rhs._height),
-	_depth(rhs._depth)
+	_depth(rhs._depth), _animated(rhs._animated)
 {
-	rhs._path = rhs._filename = rhs._extension = nullptr;
+	rhs._path = rhs._filename = rhs._extension = rhs._member = nullptr;
 }
 
-ImageInfo ImageInfo::operator=(ImageInfo&& rhs) noexcept
+ImageInfo& ImageInfo::operator=(ImageInfo&& rhs) noexcept
 {
 	if (this == &rhs)
 		return *this;
 
+	if (_path)
+		delete[] _path;
 	_path = rhs._path;
 	_filename = rhs._filename;
 	_extension = rhs._extension;
+	_member = rhs._member;
 	_size = rhs._size;
 	_lastModified = rhs._lastModified;
 	_format = rhs._format;
 	_width = rhs._width;
 	_height = rhs._height;
 	_depth = rhs._depth;
+	_animated = rhs._animated;
 
-	rhs._path = rhs._filename = rhs._extension = nullptr;
+	rhs._path = rhs._filename = rhs._extension = rhs._member = nullptr;
 
 	return *this;
 }
@@ -268,36 +250,185 @@ ImageInfo::~ImageInfo()
 bool ImageInfo::browse(const QString& image)
 {
 	QFileInfo info(image);
-	if (!info.exists() || !info.isReadable()
-			|| getImageFormat(image) == ImageFormat::unknown)
+	if (!info.exists() || !info.isReadable())
+		return false;
+
+	/* The same mapping is used to get the format and parse the header, only
+	 * the touched pages are read. */
+	MappedFile img;
+	if (!img.open(image))
+		return false;
+	ImageFormat format = getImageFormat(img.data(), img.size());
+	if (format == ImageFormat::unknown)
+		return false;
+
+	setPath(info.canonicalFilePath().toUtf8());
+
+	_size = info.size();
+	_lastModified = info.lastModified().toMSecsSinceEpoch();
+
+	_format = format;
+	_animated = false;
+
+	if (!probe([&img](qint64 size) { return img.prefix(size); }))
+		decode(img.prefix(img.size()));
+
+	gDebug() << "File:" << _filename << "W:" << _width << "H:" << _height
+		<< "D:" << _depth << "A:" << _animated;
+
+	return true;
+}
+
+bool ImageInfo::browse(const QString& image, const QByteArray& head,
+		qint64 size, qint64 lastModified)
+{
+	ImageFormat format = getImageFormat(head.constData(), head.size());
+	if (format == ImageFormat::unknown)
+		return false;
+
+	setPath(image.toUtf8());
+
+	_size = size;
+	_lastModified = lastModified;
+
+	_format = format;
+	_animated = false;
+
+	MappedFile img;
+	auto prefix = [&image, &head, size, &img](qint64 len) {
+		if (len <= head.size() || head.size() >= size)
+			return QByteArray::fromRawData(head.constData(),
+					std::min<qint64>(len, head.size()));
+		if (!img.data() && !img.open(image))
+			return QByteArray();
+		return img.prefix(len);
+	};
+	if (!probe(prefix)) {
+		if (img.data() || img.open(image))
+			decode(img.prefix(img.size()));
+	}
+
+	gDebug() << "File:" << _filename << "W:" << _width << "H:" << _height
+		<< "D:" << _depth << "A:" << _animated;
+
+	return true;
+}
+
+bool ImageInfo::browse(const ZipArchive& archive, int index)
+{
+	/* Only the needed prefix is inflated. */
+	QByteArray buf = archive.read(index, kProbeSize[0]);
+	ImageFormat format = getImageFormat(buf.constData(), buf.size());
+	if (format == ImageFormat::unknown)
 		return false;
 
+	const ZipArchive::Entry& entry = archive.entries().at(index);
+	QByteArray archivePath = archive.path().toUtf8();
+	setPath(archivePath + '/' + entry.name.toUtf8(), archivePath.size() + 1);
+
+	_size = static_cast<qint64>(entry.size);
+	_lastModified = entry.lastModified;
+
+	_format = format;
+	_animated = false;
+
+	auto prefix = [&archive, index, &buf](qint64 size) {
+		if (buf.size() < size)
+			buf = archive.read(index, size);
+		return buf;
+	};
+	if (!probe(prefix))
+		decode(archive.read(index));
+
+	gDebug() << "File:" << _filename << "in" << archive.path() << "W:"
+		<< _width << "H:" << _height << "D:" << _depth << "A:" << _animated;
+
+	return true;
+}
+
+std::unique_ptr<QIODevice> ImageInfo::open() const
+{
+	if (!_path)
+		return nullptr;
+
+	std::unique_ptr<QIODevice> dev;
+	if (_member) {
+		std::shared_ptr<ZipArchive> archive = ZipArchive::open(archivePath());
+		if (archive)
+			dev = archive->device(archive->find(memberName()));
+	} else {
+		dev = std::make_unique<QFile>(absPath());
+	}
+
+	if (!dev || !dev->open(QIODevice::ReadOnly)) {
+		gWarn() << "Failed to open" << _path;
+		return nullptr;
+	}
+	return dev;
+}
+
+void ImageInfo::copyPath(const ImageInfo& rhs)
+{
+	if (!rhs._path)
+		return;
+	qsizetype len = strlen(rhs._path);
+	_path = new char[len + 1];
+	strcpy(_path, rhs._path);
+	_filename = _path + len - strlen(rhs._filename);
+	_extension = _path + len - strlen(rhs._extension);
+	_member = rhs._member ? _path + (rhs._member - rhs._path) : nullptr;
+}
+
+void ImageInfo::setPath(const QByteArray& path, qsizetype member)
+{
 	if (_path) {
 		delete[] _path;
-		_path = _filename = _extension = nullptr;
+		_path = _filename = _extension = _member = nullptr;
 	}
 
-	QByteArray path = info.canonicalFilePath().toUtf8();
-	QByteArray filename = info.fileName().toUtf8();
-	QByteArray extension = info.suffix().toUtf8();
-
 	_path = new char[path.size() + 1];
 	strcpy(_path, path);
-	_filename = _path + path.size() - filename.size();
-	_extension = _filename + filename.size() - extension.size();
-
-	_size = info.size();
-	_lastModified = info.lastModified().toMSecsSinceEpoch();
+	char* slash = strrchr(_path, '/');
+	_filename = slash ? slash + 1 : _path;
+	char* dot = strrchr(_filename, '.');
+	_extension = dot ? dot + 1 : _path + path.size();
+	_member = member >= 0 && member <= path.size() ? _path + member : nullptr;
+}
+
+bool ImageInfo::probe(const std::function<QByteArray(qint64 size)>& prefix)
+{
+	ImageHeader header;
+	for (const qint64& size : kProbeSize) {
+		QByteArray buf = prefix(size);
+		if (readImageHeader(buf.constData(), buf.size(), _format, &header)) {
+			_width = header.width;
+			_height = header.height;
+			_depth = header.depth;
+			_animated = header.animated;
+			return true;
+		}
+		if (buf.size() < size)
+			break;
+	}
+	return false;
+}
 
-	_format = getImageFormat(image);
+void ImageInfo::decode(const QByteArray& data)
+{
+	gWarn() << "Failed to parse the header of" << _filename
+		<< ", decode it fully.";
 
 	if (_format == ImageFormat::gif) {
-		QImage img(_path, imageFormatToStr(_format));
+		QImage img = QImage::fromData(data, imageFormatToStr(_format));
 		_width = img.width();
 		_height = img.height();
 		_depth = img.depth();
 	} else {
-		cv::Mat img = cv::imread(_path);
+		/* imdecode() doesn't modify the data. */
+		cv::Mat buf(1, static_cast<int>(data.size()), CV_8U,
+				const_cast<char*>(data.constData()));
+		cv::Mat img = data.isEmpty() ? cv::Mat()
+			: cv::imdecode(buf, cv::IMREAD_COLOR);
 		_width = img.cols;
 		_height = img.rows;
 		switch (img.depth()) {
@@ -312,11 +443,6 @@ bool ImageInfo::browse(const QString& image)
 			break;
 		}
 	}
-
-	gDebug() << "File:" << _filename << "W:" << _width << "H:" << _height
-		<< "D:" << _depth;
-
-	return true;
 }
 
 QString ImageInfo::absPath() const
@@ -324,6 +450,28 @@ QString ImageInfo::absPath() const
 	return _path;
 }
 
+std::string_view ImageInfo::pathKey() const
+{
+	return _path ? std::string_view(_path) : std::string_view();
+}
+
+bool ImageInfo::inArchive() const
+{
+	return _member != nullptr;
+}
+
+QString ImageInfo::archivePath() const
+{
+	if (!_member)
+		return QString();
+	return QString::fromUtf8(_path, _member - _path - 1);
+}
+
+QString ImageInfo::memberName() const
+{
+	return _member ? QString::fromUtf8(_member) : QString();
+}
+
 QString ImageInfo::filename() const
 {
 	return _filename;
@@ -374,6 +522,11 @@ int ImageInfo::depth() const
 	return _depth;
 }
 
+bool ImageInfo::animated() const
+{
+	return _animated;
+}
+
 bool ImageInfo::empty() const
 {
 	return _path == nullptr;
@@ -381,6 +534,8 @@ bool ImageInfo::empty() const
 
 bool operator==(const ImageInfo& lhs, const ImageInfo& rhs)
 {
+	if (!lhs._path || !rhs._path)
+		return lhs._path == rhs._path;
 	return strcmp(lhs._path, rhs._path) == 0;
 }
 
@@ -389,4 +544,30 @@ bool operator!=(const ImageInfo& lhs, const ImageInfo& rhs)
 	return !(lhs == rhs);
 }
 
+QDataStream& operator<<(QDataStream& out, const ImageInfo& info)
+{
+	qint32 member = info._member ? info._member - info._path : -1;
+	out << QByteArray(info._path ? info._path : "") << member << info._size
+		<< info._lastModified << static_cast<quint8>(info._format)
+		<< info._width << info._height << info._depth << info._animated;
+	return out;
+}
+
+QDataStream& operator>>(QDataStream& in, ImageInfo& info)
+{
+	QByteArray path;
+	qint32 member = -1;
+	quint8 format = 0;
+	in >> path >> member >> info._size >> info._lastModified >> format
+		>> info._width >> info._height >> info._depth >> info._animated;
+	info._format = static_cast<ImageFormat>(format);
+	if (path.isEmpty()) {
+		delete[] info._path;
+		info._path = info._filename = info._extension = info._member = nullptr;
+	} else {
+		info.setPath(path, member);
+	}
+	return in;
+}
+
 }  /* img_view */
@@ -6,12 +6,21 @@
 #ifndef IMAGE_INFO_H
 #define IMAGE_INFO_H
 
+#include <functional>
+#include <memory>
+#include <string_view>
+
 #include <QString>
 #include <QSize>
 #include <QFile>
+#include <QDataStream>
+
+#include "lru_cache.h"
 
 namespace img_view {
 
+class ZipArchive;
+
 enum class ImageFormat {
 	unknown = 0,
 	bmp,
@@ -21,13 +30,32 @@ enum class ImageFormat {
 	webp
 };
 
+/* The number of bytes needed to get the image format. */
+constexpr qint64 kSniffSize = 16;
+
+/* The number of bytes containing the header of most images. */
+constexpr qint64 kHeadSize = 4 * 1024;
+
 /**
  * @brief Get the format of the IMAGE
  *
+ * Only the first kSniffSize bytes of the file are read.
+ *
  * @return The image format
  */
 ImageFormat getImageFormat(const QString& image);
 
+/**
+ * @brief Get the format of the image whose beginning is DATA
+ *
+ * @param data The beginning of the image file, usually the first kSniffSize
+ *             bytes, it can be shared with readImageHeader()
+ * @param len Length of DATA in bytes
+ *
+ * @return The image format
+ */
+ImageFormat getImageFormat(const char* data, const qint64& len);
+
 /**
  * @brief Get the format of the image data stream IMAGE
  *
@@ -96,13 +124,15 @@ bool isWebp(QDataStream& data);
 class ImageInfo {
 	friend bool operator==(const ImageInfo& lhs, const ImageInfo& rhs);
 	friend bool operator!=(const ImageInfo& lhs, const ImageInfo& rhs);
+	friend QDataStream& operator<<(QDataStream& out, const ImageInfo& info);
+	friend QDataStream& operator>>(QDataStream& in, ImageInfo& info);
 
 public:
 	ImageInfo();
 	ImageInfo(const ImageInfo& rhs);
-	ImageInfo operator=(const ImageInfo& rhs);
+	ImageInfo& operator=(const ImageInfo& rhs);
 	ImageInfo(ImageInfo&& rhs) noexcept;
-	ImageInfo operator=(ImageInfo&& rhs) noexcept;
+	ImageInfo& operator=(ImageInfo&& rhs) noexcept;
 	~ImageInfo();
 
 	/**
@@ -115,11 +145,49 @@ public:
 	 */
 	bool browse(const QString& image);
 
+	/**
+	 * @brief Browse the image whose beginning is already read, the file is
+	 *        opened only when its header is not fully contained in HEAD
+	 *
+	 * @param image The absolute path of the image, it is used as is
+	 * @param head The first kHeadSize bytes of the image, or the whole image
+	 *             when it is smaller
+	 * @param size The image file size in bytes
+	 * @param lastModified The last modified timestamp of the image file
+	 *
+	 * @return True when succeeded, false when it is not an image file
+	 */
+	bool browse(const QString& image, const QByteArray& head, qint64 size,
+			qint64 lastModified);
+
+	/**
+	 * @brief Browse the member INDEX of ARCHIVE and get its infomation, the
+	 *        path of the image is the archive path followed by the member name
+	 *
+	 * @return True when succeeded, false when the member is not an image file
+	 */
+	bool browse(const ZipArchive& archive, int index);
+
+	/**
+	 * @brief Open the image for reading, the members of archives are read out
+	 *        of the archives
+	 *
+	 * @return The opened device, or nullptr when failed
+	 */
+	std::unique_ptr<QIODevice> open() const;
+
 	/**
 	 * @brief Get the absolute path of the image
 	 */
 	QString absPath() const;
 
+	/**
+	 * @brief Get the absolute path of the image in UTF-8 without copying, it
+	 *        is valid as long as the image information is alive and
+	 *        unchanged
+	 */
+	std::string_view pathKey() const;
+
 	/**
 	 * @brief Get the image filename
 	 */
@@ -130,6 +198,23 @@ public:
 	 */
 	QString extension() const;
 
+	/**
+	 * @brief Check if the image is a member of an archive
+	 */
+	bool inArchive() const;
+
+	/**
+	 * @brief Get the absolute path of the archive containing the image, it is
+	 *        empty when the image is not in an archive
+	 */
+	QString archivePath() const;
+
+	/**
+	 * @brief Get the path of the image in its archive, it is empty when the
+	 *        image is not in an archive
+	 */
+	QString memberName() const;
+
 	/**
 	 * @brief Get the image MIME format
 	 */
@@ -171,26 +256,95 @@ public:
 	 */
 	int depth() const;
 
+	/**
+	 * @brief Check if the image is an animated webp or png (APNG) image, gif
+	 *        images are not checked
+	 */
+	bool animated() const;
+
 	/**
 	 * @brief Check if the image information is empty.
 	 */
 	bool empty() const;
 
+private:
+	/**
+	 * @brief Make a deep copy of the path of RHS, the current path must have
+	 *        been released.
+	 */
+	void copyPath(const ImageInfo& rhs);
+
+	/**
+	 * @brief Replace the path with PATH in UTF-8, the filename and the
+	 *        extension are taken from it.
+	 *
+	 * @param member Offset of the member name in PATH when the image is in an
+	 *        archive, otherwise -1
+	 */
+	void setPath(const QByteArray& path, qsizetype member = -1);
+
+	/**
+	 * @brief Get the dimensions and depth from the image header.
+	 *
+	 * @param prefix Get the first SIZE bytes of the image, or less at the end
+	 *        of the image
+	 *
+	 * @return True when succeeded
+	 */
+	bool probe(const std::function<QByteArray(qint64 size)>& prefix);
+
+	/**
+	 * @brief Decode the full image to get the dimensions and depth, it is
+	 *        much slower than probe().
+	 *
+	 * @param data The whole image file
+	 */
+	void decode(const QByteArray& data);
+
 private:
 	char* _path = nullptr;
 	char* _filename = nullptr;
 	char* _extension = nullptr;
+	/* The member name in _path, nullptr when not in an archive. */
+	char* _member = nullptr;
 	qint64 _size = 0;
 	qint64 _lastModified = 0;
 	ImageFormat _format = ImageFormat::unknown;
 	int _width = 0;
 	int _height = 0;
 	int _depth = 0;
+	bool _animated = false;
 };
 
 bool operator==(const ImageInfo& lhs, const ImageInfo& rhs);
 bool operator!=(const ImageInfo& lhs, const ImageInfo& rhs);
 
+/**
+ * @brief Write the image information to OUT, it can be read back without
+ *        browsing the image again.
+ */
+QDataStream& operator<<(QDataStream& out, const ImageInfo& info);
+
+/**
+ * @brief Read the image information written by operator<<().
+ */
+QDataStream& operator>>(QDataStream& in, ImageInfo& info);
+
+/* Cache images by their paths, so they can be looked up by the paths. */
+template <>
+struct LruKeyTraits<ImageInfo> {
+	typedef std::string_view View;
+
+	static View view(const ImageInfo& key) { return key.pathKey(); }
+
+	/* A modified image is a different one. */
+	static bool same(const ImageInfo& lhs, const ImageInfo& rhs)
+	{
+		return lhs.lastModified() == rhs.lastModified()
+			&& lhs.size() == rhs.size();
+	}
+};
+
 }  /* img_view */
 
 namespace std
@@ -200,8 +354,8 @@ template<>
 struct hash<img_view::ImageInfo> {
 	std::size_t operator()(const img_view::ImageInfo& key) const
 	{
-		return hash<QString>{}(key.absPath())
-			^ (hash<qint64>{}(key.lastModified()) << 1);
+		/* Equal images have the same path. */
+		return hash<std::string_view>{}(key.pathKey());
 	}
 };
 
@@ -8,28 +8,73 @@
 #ifndef LRU_CACHE_H
 #define LRU_CACHE_H
 
+#include <cstddef>
 #include <list>
 #include <unordered_map>
 
 namespace img_view
 {
 
-template <typename Key, typename Value>
+/* Every item costs 1, so the cache is bounded by the number of items. */
+template <typename Value>
+struct UnitCost {
+	std::size_t operator()(const Value&) const { return 1; }
+};
+
+/*
+ * How the cache indexes its keys. Specialize it to look up the items by a
+ * lightweight view of the key (e.g. a string view of a path inside the key)
+ * instead of the key itself.
+ */
+template <typename Key>
+struct LruKeyTraits {
+	/* The type to index the items, it must be hashable by std::hash and
+	 * stay valid as long as the key it comes from is alive. */
+	typedef Key View;
+
+	static const View& view(const Key& key) { return key; }
+
+	/* Check if the cached key is the same version as the key being looked
+	 * up, a stale item is treated as missed and removed. */
+	static bool same(const Key&, const Key&) { return true; }
+};
+
+/*
+ * The cache is bounded by the total cost of its items, the cost of an item is
+ * given by Cost, a functor which returns the cost of a value, e.g. its size
+ * in bytes.
+ */
+template <typename Key, typename Value, typename Cost = UnitCost<Value>,
+		typename Traits = LruKeyTraits<Key>>
 class LruCache {
+public:
+	typedef typename Traits::View KeyView;
+
 private:
-	typedef std::list<std::pair<Key, Value>> CacheList;
-	typedef std::unordered_map<Key, typename CacheList::iterator> CacheMap;
+	struct Item {
+		Key key;
+		Value value;
+		std::size_t cost;
+	};
+	typedef std::list<Item> CacheList;
+	/* The views in the map refer to the keys in the list, whose nodes never
+	 * move. */
+	typedef std::unordered_map<KeyView, typename CacheList::iterator>
+		CacheMap;
 
 public:
 	static const Value kNotFound;
 
 public:
 	/**
-	 * @param n Max number of cache items.
+	 * @param maxCost Max total cost of cache items.
 	 */
-	LruCache(int n = 30) : _maxCapacity(n) {}
+	LruCache(std::size_t maxCost = 30) : _maxCost(maxCost) {}
 	~LruCache() {}
 
+	LruCache(const LruCache&) = delete;
+	LruCache& operator=(const LruCache&) = delete;
+
 	/**
 	 * @brief Get the value corresponding with the KEY.
 	 *
@@ -41,61 +86,219 @@ public:
 	 */
 	const Value& get(const Key& key)
 	{
-		if (_cacheMap.find(key) == _cacheMap.end())
-			return kNotFound;
-		update(key, _cacheMap.at(key)->second);
-		return _cacheList.back().second;
+		const Value* value = find(key);
+		return value ? *value : kNotFound;
+	}
+
+	/**
+	 * @brief Get the value corresponding with the key whose view is VIEW,
+	 *        without constructing a key.
+	 *
+	 * @return The same as get().
+	 */
+	const Value& lookup(const KeyView& view)
+	{
+		const Value* value = findView(view);
+		return value ? *value : kNotFound;
+	}
+
+	/**
+	 * @brief Find the value corresponding with the key whose view is VIEW,
+	 *        without constructing a key.
+	 *
+	 * @return The same as find().
+	 */
+	const Value* findView(const KeyView& view)
+	{
+		auto iter = hit(_cacheMap.find(view));
+		return iter != _cacheList.end() ? &iter->value : nullptr;
+	}
+
+	/**
+	 * @brief Find the value corresponding with the KEY.
+	 *
+	 * @return The pointer to the value, or nullptr when there is no value
+	 *         corresponding with the KEY, it is valid until the next
+	 *         modification of the cache.
+	 */
+	const Value* find(const Key& key)
+	{
+		auto found = _cacheMap.find(Traits::view(key));
+		if (found != _cacheMap.end()
+				&& !Traits::same(found->second->key, key)) {
+			remove(found->second);
+			found = _cacheMap.end();
+		}
+		auto iter = hit(found);
+		return iter != _cacheList.end() ? &iter->value : nullptr;
 	}
 
 	/**
-	 * @brief Put the specified KEY - VALUE pair into cache.
+	 * @brief Put the specified KEY - VALUE pair into cache, the value is
+	 *        replaced if KEY is already in cache.
+	 *
+	 * The least recently used items are removed until the total cost is
+	 * within the max cost, except the new one, so an item costs more than
+	 * the max cost is still cached until the next put.
 	 */
 	void put(const Key& key, const Value& value)
 	{
-		if (_cacheMap.find(key) != _cacheMap.end()) {
-			update(key, _cacheMap.at(key)->second);
-			return;
+		auto found = _cacheMap.find(Traits::view(key));
+		if (found != _cacheMap.end()) {
+			/* The key may be a newer version, replace it and its view. */
+			auto iter = found->second;
+			_cacheMap.erase(found);
+			iter->key = key;
+			_cacheMap.emplace(Traits::view(iter->key), iter);
+
+			std::size_t cost = Cost()(value);
+			_cost = _cost - iter->cost + cost;
+			iter->value = value;
+			iter->cost = cost;
+			_cacheList.splice(_cacheList.end(), _cacheList, iter);
+		} else {
+			add(key, value);
 		}
-		if (_capacity >= _maxCapacity)
-			remove();
-		add(key, value);
+		trim(1);
+	}
+
+	/**
+	 * @brief Remove the item whose key's view is VIEW, e.g. when the key is
+	 *        known to be out of date.
+	 *
+	 * @return False when there is no such item
+	 */
+	bool erase(const KeyView& view)
+	{
+		auto found = _cacheMap.find(view);
+		if (found == _cacheMap.end())
+			return false;
+		remove(found->second);
+		return true;
 	}
 
+	/**
+	 * @brief Set the max total cost of cache items, remove the least recently
+	 *        used items if the total cost exceeds it.
+	 */
+	void setMaxCost(std::size_t maxCost)
+	{
+		_maxCost = maxCost;
+		trim(0);
+	}
+
+	/**
+	 * @brief Remove the least recently used item.
+	 *
+	 * @return False when the cache is empty
+	 */
+	bool evict()
+	{
+		if (_cacheList.empty())
+			return false;
+		remove(_cacheList.begin());
+		++_evictions;
+		return true;
+	}
+
+	/**
+	 * @brief Get the value of the least recently used item, which is evicted
+	 *        next, without making it recently used.
+	 *
+	 * @return The pointer to the value, or nullptr when the cache is empty
+	 */
+	const Value* oldest() const
+	{
+		return _cacheList.empty() ? nullptr : &_cacheList.front().value;
+	}
+
+	/**
+	 * @brief Get the max total cost of cache items.
+	 */
+	std::size_t maxCost() const { return _maxCost; }
+
+	/**
+	 * @brief Get the total cost of cache items.
+	 */
+	std::size_t cost() const { return _cost; }
+
+	/**
+	 * @brief Get the number of cache items.
+	 */
+	std::size_t size() const { return _cacheList.size(); }
+
+	/**
+	 * @brief Get the number of lookups which found the key.
+	 */
+	std::size_t hits() const { return _hits; }
+
+	/**
+	 * @brief Get the number of lookups which didn't find the key.
+	 */
+	std::size_t misses() const { return _misses; }
+
+	/**
+	 * @brief Get the number of items removed to keep the total cost within
+	 *        the max cost.
+	 */
+	std::size_t evictions() const { return _evictions; }
+
 private:
+	/* Make the item FOUND the most recently used by moving its node to the
+	 * end of the list, neither allocation nor copy happens.
+	 *
+	 * Return the item in the list, or the end of the list when missed. */
+	typename CacheList::iterator hit(typename CacheMap::iterator found)
+	{
+		if (found == _cacheMap.end()) {
+			++_misses;
+			return _cacheList.end();
+		}
+		++_hits;
+		_cacheList.splice(_cacheList.end(), _cacheList, found->second);
+		return found->second;
+	}
+
 	/* Add a new KEY - VALUE pair. */
 	void add(const Key& key, const Value& value)
 	{
-		_cacheList.push_back(std::make_pair(key, value));
-		_cacheMap[key] = --_cacheList.end();
-		++_capacity;
+		std::size_t cost = Cost()(value);
+		_cacheList.push_back(Item{ key, value, cost });
+		auto iter = --_cacheList.end();
+		_cacheMap.emplace(Traits::view(iter->key), iter);
+		_cost += cost;
 	}
 
-	/* Remove the the least recently used cache. */
-	void remove()
+	/* Remove the item ITER. */
+	void remove(typename CacheList::iterator iter)
 	{
-		Key key = _cacheList.front().first;
-		_cacheList.pop_front();
-		_cacheMap.erase(key);
-		--_capacity;
+		_cost -= iter->cost;
+		_cacheMap.erase(Traits::view(iter->key));
+		_cacheList.erase(iter);
 	}
 
-	/* Update the KEY - VALUE pair, make it the most recently used. */
-	void update(const Key& key, const Value& value)
+	/* Remove the least recently used items until the total cost is within
+	 * the max cost, the most recently used KEEP items are kept. */
+	void trim(std::size_t keep)
 	{
-		_cacheList.push_back(std::make_pair(key, value));
-		_cacheList.erase(_cacheMap.at(key));
-		_cacheMap[key] = --_cacheList.end();
+		while (_cost > _maxCost && _cacheList.size() > keep)
+			evict();
 	}
 
 private:
 	CacheList _cacheList;
 	CacheMap _cacheMap;
-	int _capacity = 0;
-	int _maxCapacity;
+	std::size_t _cost = 0;
+	std::size_t _maxCost;
+
+	/* Statistics. */
+	std::size_t _hits = 0;
+	std::size_t _misses = 0;
+	std::size_t _evictions = 0;
 };
 
-template <typename Key, typename Value>
-const Value LruCache<Key, Value>::kNotFound = Value();
+template <typename Key, typename Value, typename Cost, typename Traits>
+const Value LruCache<Key, Value, Cost, Traits>::kNotFound = Value();
 
 };  /* img_view */
 
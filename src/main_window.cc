@@ -5,6 +5,8 @@
  */
 #include "main_window.h"
 
+#include <algorithm>
+
 #include <QStandardPaths>
 #include <QImageReader>
 #include <QImageWriter>
@@ -16,11 +18,16 @@
 #include "ui/main_window_ui.h"
 #include "debug.h"
 #include "options.h"
+#include "zip_archive.h"
 
 namespace img_view {
 
 QString MainWindow::_lastOpenPos = "";
 
+/* Number of pages prefetched in and against the reading direction. */
+static constexpr int kReadAhead = 3;
+static constexpr int kReadBehind = 1;
+
 MainWindow::MainWindow(QWidget* parent) : QMainWindow(parent),
 	_ui(new ui::MainWindowUi)
 {
@@ -57,13 +64,31 @@ bool MainWindow::loadFile(const QString& filename)
 	QFileInfo info(filename);
 	if (!info.exists())
 		return false;
-	if (info.isDir()) {
+
+	_paper->erase();
+	_thumbnailer.cancel();
+	_book.close();
+	/* The book returns once the requested page is browsed, the rest pages
+	 * are added later, see onPagesAdded(). */
+	if (info.isDir() || ZipArchive::isArchive(filename))
 		_book.open(info.canonicalFilePath());
-	} else {
-		_book.open(info.canonicalPath());
-		_book.setCurPage(info.canonicalFilePath());
-	}
-	return !_book.empty() && _paper->browse(filename);
+	else
+		_book.open(info.canonicalPath(), info.canonicalFilePath());
+
+	bool shown = !_book.empty() && _paper->browse(_book.curPage())
+		&& _paper->draw();
+	gOpt.setShow(shown);
+	updatePageState();
+	_readForward = true;
+	prefetch();
+	return shown;
+}
+
+void MainWindow::updatePageState()
+{
+	gOpt.setIsFirstPage(_book.empty() || _book.pageNum() == 0);
+	gOpt.setIsLastPage(_book.empty()
+			|| _book.pageNum() == _book.pageList().size() - 1);
 }
 
 void MainWindow::setupSlots()
@@ -78,6 +103,36 @@ void MainWindow::setupSlots()
 	connect(_paper, &Paper::toPrevPage, this, &MainWindow::onToPrevPage);
 	connect(_paper, &Paper::toNextPage, this, &MainWindow::onToNextPage);
 
+	connect(&_book, &Book::pagesAdded, this, &MainWindow::onPagesAdded);
+	connect(&_book, &Book::pagesChanged, this, &MainWindow::onPagesChanged);
+	connect(&_book, &Book::scanFinished,
+			this, &MainWindow::generateThumbnails);
+	connect(&gOpt, &Options::pageListStyleChanged,
+			this, &MainWindow::generateThumbnails);
+
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkFileCloseEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkFileSaveAsEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkFilePrintEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkJumpPrevPageEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkJumpNextPageEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkJumpFirstPageEnabled);
+	connect(&gOpt, &Options::showChanged,
+			this, &MainWindow::checkJumpLastPageEnabled);
+	connect(&gOpt, &Options::isFirstPageChanged,
+			this, &MainWindow::checkJumpPrevPageEnabled);
+	connect(&gOpt, &Options::isFirstPageChanged,
+			this, &MainWindow::checkJumpFirstPageEnabled);
+	connect(&gOpt, &Options::isLastPageChanged,
+			this, &MainWindow::checkJumpNextPageEnabled);
+	connect(&gOpt, &Options::isLastPageChanged,
+			this, &MainWindow::checkJumpLastPageEnabled);
+
 	connect(_ui->_helpAbout, &QAction::triggered,
 			this, &MainWindow::onHelpAbout);
 }
@@ -89,16 +144,17 @@ void MainWindow::onFileOpen()
 	if (dialog.exec() == QDialog::Accepted) {
 		QString image = dialog.selectedFiles().constFirst();
 		_lastOpenPos = dialog.directory().absolutePath();
-		_book.open(_lastOpenPos);
-		_book.setCurPage(image);
-		if (_paper->browse(_book.curPage()))
-			_paper->draw();
+		loadFile(image);
 	}
 }
 
 void MainWindow::onFileClose()
 {
 	_paper->erase();
+	_thumbnailer.cancel();
+	_book.close();
+	gOpt.setShow(false);
+	updatePageState();
 }
 
 void MainWindow::onFileExit()
@@ -115,16 +171,81 @@ void MainWindow::onHelpAbout()
 
 void MainWindow::onToPrevPage()
 {
-	_paper->erase();
+	if (_book.empty())
+		return;
+	/* Don't erase, the current image keeps shown until the new one is
+	 * decoded. */
 	if (_paper->browse(_book.toPrevPage()))
 		_paper->draw();
+	updatePageState();
+	_readForward = false;
+	prefetch();
 }
 
 void MainWindow::onToNextPage()
 {
-	_paper->erase();
+	if (_book.empty())
+		return;
 	if (_paper->browse(_book.toNextPage()))
 		_paper->draw();
+	updatePageState();
+	_readForward = true;
+	prefetch();
+}
+
+void MainWindow::onPagesAdded()
+{
+	updatePageState();
+	/* The neighbours of the current page may be just added. */
+	prefetch();
+}
+
+void MainWindow::onPagesChanged(const QList<ImageInfo>& stale,
+		bool curPageChanged)
+{
+	/* Only the images of the changed pages are dropped, the others keep
+	 * cached. */
+	for (const ImageInfo& info : stale)
+		_paper->invalidate(info);
+
+	if (curPageChanged) {
+		_paper->erase();
+		bool shown = !_book.empty() && _paper->browse(_book.curPage())
+			&& _paper->draw();
+		gOpt.setShow(shown);
+	}
+	updatePageState();
+	prefetch();
+	generateThumbnails();
+}
+
+void MainWindow::generateThumbnails()
+{
+	if (gOpt.pageListStyle() != ListStyle::Thumbnail) {
+		_thumbnailer.cancel();
+		return;
+	}
+	/* Wait for the whole page list. */
+	if (_book.empty() || _book.scanning())
+		return;
+	_thumbnailer.request(_book.pageList(), _book.pageNum());
+}
+
+void MainWindow::prefetch()
+{
+	if (_book.empty())
+		return;
+
+	/* The nearest pages first. */
+	QList<ImageInfo> ahead = _readForward ? _book.nextPages(kReadAhead)
+		: _book.prevPages(kReadAhead);
+	QList<ImageInfo> behind = _readForward ? _book.prevPages(kReadBehind)
+		: _book.nextPages(kReadBehind);
+	if (!_readForward)
+		std::reverse(ahead.begin(), ahead.end());
+	else
+		std::reverse(behind.begin(), behind.end());
+	_paper->prefetch(ahead + behind);
 }
 
 void MainWindow::checkFileCloseEnabled()
@@ -204,6 +325,11 @@ void MainWindow::initImgFileDialog(QFileDialog* dialog,
 	QStringList mime_type_filters;
 	for (const QByteArray& mime_type_name : Paper::supportedMimeTypes())
 		mime_type_filters.append(mime_type_name);
+	/* Comic book archives are opened as books. */
+	if (accept_mode == QFileDialog::AcceptOpen) {
+		mime_type_filters.append("application/zip");
+		mime_type_filters.append("application/vnd.comicbook+zip");
+	}
 	mime_type_filters.append("application/octet-stream");  /* All files. */
 	mime_type_filters.sort();
 	dialog->setMimeTypeFilters(mime_type_filters);
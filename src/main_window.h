@@ -11,6 +11,7 @@
 
 #include "paper.h"
 #include "book.h"
+#include "thumbnailer.h"
 
 namespace img_view {
 
@@ -37,6 +38,11 @@ private slots:
 	void onCtrlMinus();
 	void onToPrevPage();
 	void onToNextPage();
+	void onPagesAdded();
+	void onPagesChanged(const QList<ImageInfo>& stale, bool curPageChanged);
+
+	/* Make the thumbnails of the pages if they are listed as thumbnails. */
+	void generateThumbnails();
 
 	/* Check and set actions' activation. */
 	void checkFileCloseEnabled();
@@ -56,6 +62,12 @@ private:
 	void setupSlots();
 	void setupShortCut();
 
+	/* Update the page navigation options of the current page. */
+	void updatePageState();
+
+	/* Prefetch the pages around the current page. */
+	void prefetch();
+
 	static void initImgFileDialog(QFileDialog* dialog,
 			const QFileDialog::AcceptMode accept_mode);
 
@@ -64,6 +76,9 @@ private:
 	ui::MainWindowUi* _ui = nullptr;
 	Paper* _paper = nullptr;
 	Book _book;
+	Thumbnailer _thumbnailer;
+	/* Whether the last page turn is to the next page. */
+	bool _readForward = true;
 };
 
 }  /* img_view */
@@ -0,0 +1,89 @@
+/**
+ * mapped_file.cc
+ *
+ * Created by vamirio on 2022 Oct 29
+ */
+#include "mapped_file.h"
+
+#include <algorithm>
+
+#include "debug.h"
+#include "image_info.h"
+#include "zip_archive.h"
+
+namespace img_view {
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const QString& path)
+{
+	close();
+	_file.setFileName(path);
+	if (!_file.open(QIODevice::ReadOnly))
+		return false;
+
+	qint64 size = _file.size();
+	if (size > 0)
+		_map = _file.map(0, size);
+	if (_map) {
+		_data = reinterpret_cast<const char*>(_map);
+		_size = size;
+		return true;
+	}
+
+	/* Some file systems can't be mapped, e.g. the pipes and procfs. */
+	gDebug() << "Failed to map" << path << ", read it instead.";
+	_buffer = _file.readAll();
+	_file.close();
+	_data = _buffer.constData();
+	_size = _buffer.size();
+	return !_buffer.isEmpty();
+}
+
+bool MappedFile::open(const ImageInfo& info)
+{
+	if (!info.inArchive())
+		return open(info.absPath());
+
+	close();
+	std::shared_ptr<ZipArchive> archive = ZipArchive::open(info.archivePath());
+	if (!archive)
+		return false;
+	_buffer = archive->read(archive->find(info.memberName()));
+	_archive = archive;
+	_data = _buffer.constData();
+	_size = _buffer.size();
+	return !_buffer.isEmpty();
+}
+
+void MappedFile::close()
+{
+	if (_map)
+		_file.unmap(_map);
+	_map = nullptr;
+	_file.close();
+	_buffer.clear();
+	_archive.reset();
+	_data = nullptr;
+	_size = 0;
+}
+
+const char* MappedFile::data() const
+{
+	return _data;
+}
+
+qint64 MappedFile::size() const
+{
+	return _size;
+}
+
+QByteArray MappedFile::prefix(qint64 len) const
+{
+	return QByteArray::fromRawData(_data, std::min(len, _size));
+}
+
+}  /* img_view */
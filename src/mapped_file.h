@@ -0,0 +1,81 @@
+/**
+ * mapped_file.h
+ *
+ * Give the whole content of an image in memory, the files are memory mapped
+ * so the repeated reads are served by the page cache without copying.
+ *
+ * Created by vamirio on 2022 Oct 29
+ */
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+namespace img_view {
+
+class ImageInfo;
+class ZipArchive;
+
+class MappedFile {
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * @brief Map the file PATH, it is read into a buffer when it can't be
+	 *        mapped.
+	 *
+	 * @return True when succeeded
+	 */
+	bool open(const QString& path);
+
+	/**
+	 * @brief Map the image INFO, the members of archives are read out of the
+	 *        archives.
+	 *
+	 * @return True when succeeded
+	 */
+	bool open(const ImageInfo& info);
+
+	/**
+	 * @brief Unmap the file and release the buffer.
+	 */
+	void close();
+
+	/**
+	 * @brief Get the content, it is valid until closed.
+	 */
+	const char* data() const;
+
+	/**
+	 * @brief Get the size of the content in bytes.
+	 */
+	qint64 size() const;
+
+	/**
+	 * @brief Get the first LEN bytes of the content without copying, it is
+	 *        valid until closed.
+	 */
+	QByteArray prefix(qint64 len) const;
+
+private:
+	QFile _file;
+	uchar* _map = nullptr;
+	/* The content when it is not mapped. */
+	QByteArray _buffer;
+	/* Keep the archive alive, the stored members refer to its mapping. */
+	std::shared_ptr<const ZipArchive> _archive;
+	const char* _data = nullptr;
+	qint64 _size = 0;
+};
+
+}  /* img_view */
+
+#endif /* ifndef MAPPED_FILE_H */
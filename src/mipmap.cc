@@ -0,0 +1,83 @@
+/**
+ * mipmap.cc
+ *
+ * Created by vamirio on 2022 Sep 10
+ */
+#include "mipmap.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "downscale.h"
+
+namespace img_view {
+
+void MipMap::reset(const cv::Mat& src)
+{
+	_levels.clear();
+	if (!src.empty())
+		_levels.push_back(src);
+}
+
+const cv::Mat& MipMap::source() const
+{
+	static const cv::Mat kEmpty;
+	return _levels.empty() ? kEmpty : _levels.front();
+}
+
+bool MipMap::empty() const
+{
+	return _levels.empty();
+}
+
+const cv::Mat& MipMap::level(const double& factor)
+{
+	if (_levels.empty())
+		return source();
+
+	const cv::Mat& src = _levels.front();
+	double width = src.cols * factor;
+	double height = src.rows * factor;
+	std::size_t i = 0;
+	for (;; ++i) {
+		if (i + 1 == _levels.size()) {
+			const cv::Mat& last = _levels.back();
+			/* The next level would be smaller than aimed. */
+			if (last.cols / 2 < width || last.rows / 2 < height
+					|| last.cols < 2 || last.rows < 2)
+				break;
+			cv::Mat next;
+			downscaleArea(last, next, cv::Size(last.cols / 2, last.rows / 2));
+			_levels.push_back(next);
+		} else if (_levels[i + 1].cols < width
+				|| _levels[i + 1].rows < height) {
+			break;
+		}
+	}
+	return _levels[i];
+}
+
+cv::Mat MipMap::scale(const double& factor, int interpolation)
+{
+	if (_levels.empty())
+		return cv::Mat();
+
+	const cv::Mat& src = _levels.front();
+	cv::Size size(std::max(1, static_cast<int>(std::lround(src.cols * factor))),
+			std::max(1, static_cast<int>(std::lround(src.rows * factor))));
+	const cv::Mat& from = level(factor);
+	if (from.size() == size)
+		return from;
+
+	cv::Mat dest;
+	if (interpolation == -1 && size.width < from.cols) {
+		downscaleArea(from, dest, size);
+		return dest;
+	}
+	if (interpolation == -1)
+		interpolation = cv::INTER_CUBIC;
+	cv::resize(from, dest, size, 0, 0, interpolation);
+	return dest;
+}
+
+}  /* img_view */
@@ -0,0 +1,72 @@
+/**
+ * mipmap.h
+ *
+ * Mipmap pyramid of an image, every level is half the size of the previous
+ * one, so scaling down can start from a level close to the aimed size rather
+ * than the full resolution image.
+ *
+ * Created by vamirio on 2022 Sep 10
+ */
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace img_view {
+
+class MipMap {
+public:
+	MipMap() = default;
+	~MipMap() = default;
+
+	/**
+	 * @brief Use SRC as the level 0, the other levels are dropped and will be
+	 *        built again when needed.
+	 */
+	void reset(const cv::Mat& src);
+
+	/**
+	 * @brief Get the full resolution image (level 0).
+	 */
+	const cv::Mat& source() const;
+
+	/**
+	 * @brief Check if there is no image.
+	 */
+	bool empty() const;
+
+	/**
+	 * @brief Get the smallest level which is not smaller than the source
+	 *        scaled by FACTOR, the levels are built lazily.
+	 *
+	 * @param factor The scale factor relative to the source
+	 *
+	 * @return The level, it is the source when FACTOR is not less than 0.5
+	 */
+	const cv::Mat& level(const double& factor);
+
+	/**
+	 * @brief Scale the source by FACTOR, starting from the nearest larger
+	 *        level.
+	 *
+	 * @param factor The scale factor relative to the source
+	 * @param interpolation The interpolation used to scale, -1 for the default
+	 *        one: downscaleArea() when scaling down and cv::INTER_CUBIC when
+	 *        scaling up
+	 *
+	 * @return The scaled image, it shares data with the level when no scaling
+	 *         is needed
+	 */
+	cv::Mat scale(const double& factor, int interpolation = -1);
+
+private:
+	/* _levels[0] is the source, _levels[i + 1] is half the size of
+	 * _levels[i]. */
+	std::vector<cv::Mat> _levels;
+};
+
+}  /* img_view */
+
+#endif /* ifndef MIPMAP_H */
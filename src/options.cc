@@ -163,6 +163,11 @@ bool Options::keepScale() const
 	return _keepScale;
 }
 
+int Options::cacheLimit() const
+{
+	return _cacheLimit;
+}
+
 void Options::setShow(const bool show)
 {
 	if (show != _show) {
@@ -387,4 +392,12 @@ void Options::setKeepScale(const bool keepScale)
 	}
 }
 
+void Options::setCacheLimit(const int cacheLimit)
+{
+	if (cacheLimit != _cacheLimit) {
+		_cacheLimit = cacheLimit;
+		emit cacheLimitChanged();
+	}
+}
+
 } /* img_view */
@@ -101,6 +101,7 @@ public:
 	bool minImage() const;
 	bool maxImage() const;
 	bool keepScale() const;
+	int cacheLimit() const;
 
 	void setShow(const bool show);
 	void setHasHistory(const bool hasHistory);
@@ -130,6 +131,7 @@ public:
 	void setMinImage(const bool minImage);
 	void setMaxImage(const bool maxImage);
 	void setKeepScale(const bool keepScale);
+	void setCacheLimit(const int cacheLimit);
 
 signals:
 	void showChanged();
@@ -160,6 +162,7 @@ signals:
 	void minImageChanged();
 	void maxImageChanged();
 	void keepScaleChanged();
+	void cacheLimitChanged();
 
 private:
 	bool _show = false;  /* Show image or not. */
@@ -200,6 +203,9 @@ private:
 	bool _minImage = true;
 	bool _maxImage = true;
 	bool _keepScale = false;
+
+	/* Max memory of the decoded images cache in MiB. */
+	int _cacheLimit = 512;
 };
 
 extern Options gOpt;
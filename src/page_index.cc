@@ -0,0 +1,127 @@
+/**
+ * page_index.cc
+ *
+ * Created by vamirio on 2022 Oct 08
+ */
+#include "page_index.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "debug.h"
+
+namespace img_view {
+
+/* The index files are named by the hash of the book path. */
+static QString indexFile(const QString& book)
+{
+	QByteArray hash = QCryptographicHash::hash(book.toUtf8(),
+			QCryptographicHash::Sha1).toHex();
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+		+ "/index/" + QString::fromLatin1(hash) + ".idx";
+}
+
+void PageIndex::load(const QString& book)
+{
+	clear();
+	_book = book;
+	_file = indexFile(book);
+
+	QFile file(_file);
+	if (!file.open(QIODevice::ReadOnly))
+		return;
+
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_6_0);
+	quint32 magic = 0;
+	quint16 version = 0;
+	QString path;
+	qint32 count = 0;
+	in >> magic >> version >> path >> count;
+	/* The hash of another book may collide. */
+	if (magic != kMagic || version != kVersion || path != book) {
+		gWarn() << "Ignore the page index" << _file;
+		return;
+	}
+
+	_pages.reserve(count);
+	for (qint32 i = 0; i != count && in.status() == QDataStream::Ok; ++i) {
+		ImageInfo page;
+		in >> page;
+		if (!page.empty())
+			_pages.insert(page.absPath(), page);
+	}
+	if (in.status() != QDataStream::Ok) {
+		gWarn() << "The page index" << _file << "is broken";
+		_pages.clear();
+	}
+	gDebug() << "Loaded" << _pages.size() << "pages from index.";
+}
+
+bool PageIndex::save()
+{
+	if (!_dirty || _file.isEmpty())
+		return true;
+
+	QDir().mkpath(QFileInfo(_file).absolutePath());
+	QSaveFile file(_file);
+	if (!file.open(QIODevice::WriteOnly)) {
+		gWarn() << "Failed to save the page index" << _file;
+		return false;
+	}
+
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_6_0);
+	out << kMagic << kVersion << _book << static_cast<qint32>(_pages.size());
+	for (const ImageInfo& page : _pages)
+		out << page;
+	if (!file.commit()) {
+		gWarn() << "Failed to save the page index" << _file;
+		return false;
+	}
+	_dirty = false;
+	return true;
+}
+
+void PageIndex::clear()
+{
+	_file.clear();
+	_book.clear();
+	_pages.clear();
+	_dirty = false;
+}
+
+bool PageIndex::restore(const QString& path, qint64 size,
+		qint64 lastModified, ImageInfo* page) const
+{
+	auto iter = _pages.constFind(path);
+	if (iter == _pages.cend() || size != iter->size()
+			|| lastModified != iter->lastModified())
+		return false;
+	*page = *iter;
+	return true;
+}
+
+void PageIndex::update(const QList<ImageInfo>& pages)
+{
+	if (pages.size() != _pages.size())
+		_dirty = true;
+
+	QHash<QString, ImageInfo> updated;
+	updated.reserve(pages.size());
+	for (const ImageInfo& page : pages) {
+		QString path = page.absPath();
+		auto iter = _pages.constFind(path);
+		if (iter == _pages.cend() || iter->size() != page.size()
+				|| iter->lastModified() != page.lastModified())
+			_dirty = true;
+		updated.insert(path, page);
+	}
+	_pages.swap(updated);
+}
+
+}  /* img_view */
@@ -0,0 +1,84 @@
+/**
+ * page_index.h
+ *
+ * Persistent index of the page information of a book, so the pages unchanged
+ * since the last time don't need to be browsed again.
+ *
+ * Created by vamirio on 2022 Oct 08
+ */
+#ifndef PAGE_INDEX_H
+#define PAGE_INDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QString>
+
+#include "image_info.h"
+
+namespace img_view {
+
+class PageIndex {
+public:
+	PageIndex() = default;
+	~PageIndex() = default;
+
+	/**
+	 * @brief Load the index of the book BOOK, the index is empty if it hasn't
+	 *        been saved or is broken.
+	 *
+	 * @param book The absolute path of the book
+	 */
+	void load(const QString& book);
+
+	/**
+	 * @brief Save the index if it is changed since loaded.
+	 *
+	 * @return False when failed to write the index file
+	 */
+	bool save();
+
+	/**
+	 * @brief Drop all entries, the index file is kept.
+	 */
+	void clear();
+
+	/**
+	 * @brief Get the information of the image PATH from the index, it is
+	 *        used only when the size and the last modified time of the file
+	 *        are unchanged.
+	 *
+	 * It can be called from multiple threads as long as the index is not
+	 * modified at the same time.
+	 *
+	 * @param path The absolute path of the image
+	 * @param size The size of the file in bytes
+	 * @param lastModified The last modified time of the file in milliseconds
+	 *        since the epoch
+	 * @param page Where to store the information
+	 *
+	 * @return True when found
+	 */
+	bool restore(const QString& path, qint64 size, qint64 lastModified,
+			ImageInfo* page) const;
+
+	/**
+	 * @brief Replace the entries with PAGES, the entries of the files not in
+	 *        PAGES are dropped.
+	 */
+	void update(const QList<ImageInfo>& pages);
+
+private:
+	/* The book and the path of its index file. */
+	QString _book;
+	QString _file;
+	QHash<QString, ImageInfo> _pages;
+	bool _dirty = false;
+
+	/* Magic number and format version of the index file. */
+	static constexpr quint32 kMagic = 0x49564958;  /* "IVIX" */
+	static constexpr quint16 kVersion = 2;
+};
+
+}  /* img_view */
+
+#endif /* ifndef PAGE_INDEX_H */
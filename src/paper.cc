@@ -14,14 +14,21 @@
 #include <QMouseEvent>
 #include <QKeyEvent>
 #include <QKeyCombination>
-#include <QMovie>
 #include <QPainter>
+#include <QPaintEvent>
+#include <QSet>
 #include <QStyle>
 #include <qboxlayout.h>
 #include <qwidget.h>
 
+#include <algorithm>
+#include <cmath>
+
+#include "batch_io.h"
 #include "debug.h"
+#include "downscale.h"
 #include "image_info.h"
+#include "options.h"
 
 namespace img_view {
 
@@ -42,31 +49,180 @@ const QSet<const QByteArray> Paper::kSupportedFormats = {
 	"webp"
 };
 
-const QImage& AntialiasImage::image() const
+const cv::Mat& TiledImage::image() const
+{
+	return _mipmap.source();
+}
+
+void TiledImage::setImage(const cv::Mat& image)
+{
+	if (image.data == _mipmap.source().data)
+		return;
+	_mipmap.reset(image);
+	clearTiles();
+	update();
+}
+
+double TiledImage::scaleFactor() const
 {
-	return _image;
+	return _factor;
 }
 
-void AntialiasImage::setImage(const QImage& image)
+void TiledImage::setScaleFactor(const double& factor)
 {
-	_image = image;
+	if (factor != _factor) {
+		_factor = factor;
+		clearTiles();
+	}
+
+	const cv::Mat& src = _mipmap.source();
+	resize(std::max(1, static_cast<int>(std::lround(src.cols * _factor))),
+			std::max(1, static_cast<int>(std::lround(src.rows * _factor))));
 	update();
 }
 
-void AntialiasImage::paintEvent(QPaintEvent*)
+void TiledImage::setPreview(bool preview)
+{
+	if (preview == _preview)
+		return;
+	_preview = preview;
+	if (preview)
+		return;
+
+	for (const quint64& key : _previewTiles)
+		_tiles.remove(key);
+	_previewTiles.clear();
+	update();
+}
+
+void TiledImage::paintEvent(QPaintEvent* event)
 {
 	QPainter painter(this);
-	painter.setRenderHints(QPainter::Antialiasing
-	                       | QPainter::SmoothPixmapTransform, true);
-	painter.drawImage(QRectF(rect()), _image);
+	if (_mipmap.empty()) {
+		painter.eraseRect(event->rect());
+		return;
+	}
+
+	/* The tiles are already in the widget size, blit the ones covering the
+	 * exposed region without any transformation. */
+	QSet<quint64> drawn;
+	for (const QRect& r : event->region()) {
+		QRect exposed = r & rect();
+		if (exposed.isEmpty())
+			continue;
+		for (int y = exposed.top() / kTileSize;
+				y <= exposed.bottom() / kTileSize; ++y) {
+			for (int x = exposed.left() / kTileSize;
+					x <= exposed.right() / kTileSize; ++x) {
+				quint64 key = tileKey(x, y);
+				if (drawn.contains(key))
+					continue;
+				drawn.insert(key);
+				painter.drawPixmap(QPoint(x * kTileSize, y * kTileSize),
+						tile(x, y));
+			}
+		}
+	}
+	evictTiles();
+}
+
+quint64 TiledImage::tileKey(int x, int y)
+{
+	return (static_cast<quint64>(y) << 32) | static_cast<quint32>(x);
+}
+
+const QPixmap& TiledImage::tile(int x, int y)
+{
+	quint64 key = tileKey(x, y);
+	auto iter = _tiles.find(key);
+	if (iter != _tiles.end())
+		return *iter;
+
+	/* The tile area in the scaled image and the level it is scaled from. */
+	QRect area = QRect(x * kTileSize, y * kTileSize, kTileSize, kTileSize)
+		& rect();
+	const cv::Mat& level = _mipmap.level(_factor);
+	double fx = 1.0 * width() / level.cols;
+	double fy = 1.0 * height() / level.rows;
+
+	/* Scale the pixels covering the tile, then cut the tile out of it. */
+	int x0 = static_cast<int>(std::floor(area.left() / fx));
+	int y0 = static_cast<int>(std::floor(area.top() / fy));
+	int x1 = std::min(level.cols,
+			static_cast<int>(std::ceil((area.right() + 1) / fx)));
+	int y1 = std::min(level.rows,
+			static_cast<int>(std::ceil((area.bottom() + 1) / fy)));
+	cv::Mat roi = level(cv::Range(y0, y1), cv::Range(x0, x1));
+	cv::Size size(std::max(1, static_cast<int>(std::lround(roi.cols * fx))),
+			std::max(1, static_cast<int>(std::lround(roi.rows * fy))));
+	cv::Mat scaled = roi;
+	if (size != roi.size()) {
+		if (_preview)
+			cv::resize(roi, scaled, size, 0, 0, cv::INTER_LINEAR);
+		else if (fx < 1)
+			downscaleArea(roi, scaled, size);
+		else
+			cv::resize(roi, scaled, size, 0, 0, cv::INTER_CUBIC);
+	}
+
+	int ox = std::clamp(static_cast<int>(std::lround(area.left() - x0 * fx)),
+			0, scaled.cols - 1);
+	int oy = std::clamp(static_cast<int>(std::lround(area.top() - y0 * fy)),
+			0, scaled.rows - 1);
+	cv::Mat part = scaled(cv::Rect(ox, oy,
+				std::min(area.width(), scaled.cols - ox),
+				std::min(area.height(), scaled.rows - oy)));
+	if (_preview)
+		_previewTiles.insert(key);
+	/* Upload the tile once, painting it later is a plain blit. */
+	return *_tiles.insert(key, QPixmap::fromImage(mat2Qimage(part)));
+}
+
+void TiledImage::evictTiles()
+{
+	QRect keep = visibleRegion().boundingRect().adjusted(-kTileSize,
+			-kTileSize, kTileSize, kTileSize);
+	for (auto iter = _tiles.begin(); iter != _tiles.end(); ) {
+		int x = static_cast<quint32>(iter.key()) * kTileSize;
+		int y = static_cast<int>(iter.key() >> 32) * kTileSize;
+		if (keep.intersects(QRect(x, y, kTileSize, kTileSize))) {
+			++iter;
+		} else {
+			_previewTiles.remove(iter.key());
+			iter = _tiles.erase(iter);
+		}
+	}
 }
 
+void TiledImage::clearTiles()
+{
+	_tiles.clear();
+	_previewTiles.clear();
+}
 
-Paper::Paper(QWidget* parent)
+/* Release the cv::Mat which owns the pixels of a QImage. */
+static void releaseMat(void* mat)
+{
+	delete static_cast<cv::Mat*>(mat);
+}
+
+QImage TiledImage::mat2Qimage(const cv::Mat& src)
+{
+	if (src.empty())
+		return QImage();
+
+	/* Share the pixels instead of copying them, the QImage holds a reference
+	 * of SRC until it is destroyed. */
+	cv::Mat* owner = new cv::Mat(src);
+	return QImage(static_cast<const uchar*>(owner->data), owner->cols,
+			owner->rows, owner->step, QImage::Format_BGR888, releaseMat, owner);
+}
+
+Paper::Paper(QWidget* parent) : _decoder(&_cache)
 {
 	_scrollArea = new QScrollArea(this);
 	_container = new QWidget(_scrollArea);
-	_image = new AntialiasImage(_scrollArea);
+	_image = new TiledImage(_scrollArea);
 	_movie = new QLabel(_scrollArea);
 
 	setVisible(true);
@@ -84,14 +240,47 @@ Paper::Paper(QWidget* parent)
 	QVBoxLayout* lay = new QVBoxLayout(_container);
 	lay->addWidget(_image);
 	lay->addWidget(_movie);
+
+	connect(&_decoder, &Decoder::decoded, this, &Paper::onDecoded);
+	connect(&_player, &AnimationPlayer::frameChanged,
+			this, &Paper::onFrameChanged);
+
+	_refineTimer.setSingleShot(true);
+	_refineTimer.setInterval(kRefineDelay);
+	connect(&_refineTimer, &QTimer::timeout, this, &Paper::onRefine);
+
+	onCacheLimitChanged();
+	connect(&gOpt, &Options::cacheLimitChanged,
+			this, &Paper::onCacheLimitChanged);
 }
 
 Paper::~Paper()
 {
+	gInfo() << "Image cache hits:" << _cache.hits()
+		<< "misses:" << _cache.misses()
+		<< "evictions:" << _cache.evictions()
+		<< "coalesced:" << _cache.coalesced();
+}
+
+void Paper::onCacheLimitChanged()
+{
+	_cache.setMaxCost(static_cast<std::size_t>(gOpt.cacheLimit()) << 20);
+}
+
+void Paper::onFrameChanged(const QImage& frame)
+{
+	_movie->setPixmap(QPixmap::fromImage(frame));
+}
+
+void Paper::onRefine()
+{
+	_image->setPreview(false);
 }
 
 bool Paper::browse(const QString& image)
 {
+	_decoder.cancel(_decodeTicket);
+	_decodeTicket = 0;
 	return _imageInfo.browse(image)
 		&& kSupportedFormats.find(imageFormatToStr(_imageInfo.format()))
 				!= kSupportedFormats.end();
@@ -99,6 +288,10 @@ bool Paper::browse(const QString& image)
 
 bool Paper::browse(const ImageInfo& info)
 {
+	if (info != _imageInfo) {
+		_decoder.cancel(_decodeTicket);
+		_decodeTicket = 0;
+	}
 	_imageInfo = info;
 	return !_imageInfo.empty();
 }
@@ -111,51 +304,89 @@ bool Paper::draw()
 
 void Paper::erase()
 {
+	_decoder.cancel(_decodeTicket);
+	_decodeTicket = 0;
+	cancelPrefetch();
+	_refineTimer.stop();
+	_image->setPreview(false);
+
 	if (isStaticImage()) {
-		_image->setImage(QImage());
+		_image->setImage(cv::Mat());
 	} else {
-		QMovie* movie = _movie->movie();
-		if (movie) {
-			_movie->setMovie(nullptr);
-			delete movie;
-		}
+		_player.stop();
+		_movie->clear();
 	}
 }
 
-/* TODO: open file which path contains Chinese character. */
 bool Paper::drawStaticImage()
 {
-	_movie->hide();
-	_image->show();
-
+	double factor = _initScaleFactor * _scaleFactor;
 	cv::Mat src = _cache.get(_imageInfo);
-	if (src.empty()) {
-		src = cv::imread(_imageInfo.absPath().toUtf8().data());
-		if (src.empty())
-			return false;
-		_cache.put(_imageInfo, src);
+	if (Decoder::covers(src, _imageInfo, factor)) {
+		_decoder.cancel(_decodeTicket);
+		_decodeTicket = 0;
+		showStaticImage(src);
+		return true;
 	}
+	/* Show the reduced image until the larger one is decoded. */
+	if (!src.empty())
+		showStaticImage(src);
+
+	/* Keep the previous image until the current one is decoded. */
+	if (_decoder.pending(_decodeTicket))
+		return true;
+	/* Wait for the prefetch instead of decoding it again. */
+	quint64 ticket = _prefetchTickets.take(_imageInfo.absPath());
+	if (_decoder.pending(ticket) && src.empty()) {
+		_decodeTicket = ticket;
+		return true;
+	}
+	_decoder.cancel(ticket);
+	_decodeTicket = _decoder.decode(_imageInfo, kDrawPriority, factor);
+	return true;
+}
 
-	cv::Mat tmp = src;
-	double factor = _initScaleFactor *  _scaleFactor;
-	if (factor != 1.0) {
-		cv::resize(src, tmp, cv::Size(0, 0), factor, factor,
-				factor < 1 ? cv::INTER_AREA : cv::INTER_CUBIC);
+void Paper::showStaticImage(const cv::Mat& src)
+{
+	_movie->hide();
+	_image->show();
+	if (!_player.fileName().isEmpty()) {
+		_player.stop();
+		_movie->clear();
 	}
-	QImage dest = mat2Qimage(tmp);
-	_container->resize(dest.size());
-	_image->resize(dest.size());
-	_image->setImage(dest);
 
-	return true;
+	/* The factors are relative to the full size, SRC may be smaller. */
+	double factor = _initScaleFactor * _scaleFactor;
+	int full = std::max(_imageInfo.width(), _imageInfo.height());
+	if (full > 0)
+		factor *= 1.0 * full / std::max(src.cols, src.rows);
+
+	/* Only the visible tiles are scaled when painting. */
+	_image->setImage(src);
+	_image->setScaleFactor(factor);
+	_container->resize(_image->size());
 }
 
-QImage Paper::mat2Qimage(const cv::Mat& src)
+void Paper::onDecoded(quint64 ticket, const ImageInfo& info,
+		const cv::Mat& image)
 {
-	QImage dest(static_cast<const uchar*>(src.data), src.cols, src.rows,
-			src.step, QImage::Format_BGR888);
-	dest.bits(); /* Enforce a deep copy, avoid reading an invalid address. */
-	return dest;
+	if (image.empty()) {
+		if (ticket == _decodeTicket)
+			_decodeTicket = 0;
+		return;
+	}
+	_prefetchTickets.remove(info.absPath());
+
+	/* Drop the stale result when the user has flipped past the page. */
+	if (ticket != _decodeTicket)
+		return;
+	_decodeTicket = 0;
+	showStaticImage(image);
+
+	/* A prefetched image may be too small for the current zoom. */
+	double factor = _initScaleFactor * _scaleFactor;
+	if (!Decoder::covers(image, _imageInfo, factor))
+		_decodeTicket = _decoder.decode(_imageInfo, kDrawPriority, factor);
 }
 
 bool Paper::drawDynamicImage()
@@ -163,26 +394,59 @@ bool Paper::drawDynamicImage()
 	_image->hide();
 	_movie->show();
 
-	if (_movie->movie()) {
-		delete _movie->movie();
-		_movie->setMovie(nullptr);
-	}
-
-	QMovie* movie = new QMovie(_imageInfo.absPath());
-	if (!movie->isValid())
+	/* Zooming goes on from the current frame instead of restarting. */
+	if (_player.fileName() != _imageInfo.absPath()
+			&& !_player.open(_imageInfo))
 		return false;
 
-	_movie->setMovie(movie);
-
 	double factor = _initScaleFactor * _scaleFactor;
 	_container->resize(_imageInfo.dimensions() * factor);
 	_movie->resize(_imageInfo.dimensions() * factor);
+	_player.setScaledSize(_imageInfo.dimensions() * factor);
 
-	_movie->movie()->setScaledSize(_imageInfo.dimensions() * factor);
+	return true;
+}
 
-	_movie->movie()->start();
+void Paper::prefetch(const QList<ImageInfo>& pages)
+{
+	QHash<QString, quint64> tickets;
+	QStringList readahead;
+	int priority = kPrefetchPriority;
+	for (const ImageInfo& info : pages) {
+		QString path = info.absPath();
+		quint64 ticket = _prefetchTickets.take(path);
+		if (_decoder.pending(ticket)) {
+			tickets.insert(path, ticket);
+			continue;
+		}
+		/* Animations are decoded by the player when shown. */
+		double factor = fitScaleFactor(info);
+		if (info == _imageInfo || isDynamicImage(info)
+				|| Decoder::covers(_cache.get(info), info, factor))
+			continue;
+		tickets.insert(path, _decoder.decode(info, priority--, factor));
+		if (!info.inArchive())
+			readahead.append(path);
+	}
 
-	return true;
+	/* The decoder reads the pages one by one, let the system read them all
+	 * ahead at once, so the reading overlaps the decoding. */
+	adviseWillNeed(readahead);
+	cancelPrefetch();
+	_prefetchTickets = tickets;
+}
+
+void Paper::cancelPrefetch()
+{
+	for (const quint64& ticket : _prefetchTickets)
+		_decoder.cancel(ticket);
+	_prefetchTickets.clear();
+}
+
+void Paper::invalidate(const ImageInfo& info)
+{
+	_decoder.cancel(_prefetchTickets.take(info.absPath()));
+	_cache.erase(info.pathKey());
 }
 
 void Paper::zoomIn(const double& step)
@@ -210,24 +474,31 @@ void Paper::scale(const double& factor)
 }
 
 void Paper::limitToWindow()
+{
+	_scaleFactor = 1.0;
+	_initScaleFactor = fitScaleFactor(_imageInfo);
+	if (_initScaleFactor == 1.0)
+		return;
+
+	gDebug() << "New W:" << _imageInfo.width() * _initScaleFactor
+		<< "H:" << _imageInfo.height() * _initScaleFactor;
+}
+
+double Paper::fitScaleFactor(const ImageInfo& info) const
 {
 	QSize window_size = size();
-	QSize image_size = _imageInfo.dimensions();
-	_initScaleFactor = _scaleFactor = 1.0;
+	QSize image_size = info.dimensions();
 
 	if (image_size.width() < window_size.width()
 			&& image_size.height() < window_size.height())
-		return;
+		return 1.0;
 
 	double w_ratio = 1.0 * window_size.width() / image_size.width();
 	double h_ratio = 1.0 * window_size.height() / image_size.height();
 
 	/* The image may be a little larger than the window if the constant is
 	 * 1.0. */
-	_initScaleFactor = 0.99 * (w_ratio < h_ratio ? w_ratio : h_ratio);
-
-	gDebug() << "New W:" << _imageInfo.width() * _initScaleFactor
-		<< "H:" << _imageInfo.height() * _initScaleFactor;
+	return 0.99 * (w_ratio < h_ratio ? w_ratio : h_ratio);
 }
 
 void Paper::adjustScrollBarPos(QScrollBar* scroll_bar, const double& factor)
@@ -257,7 +528,12 @@ bool Paper::isStaticImage() const
 
 bool Paper::isDynamicImage() const
 {
-	return _imageInfo.format() == ImageFormat::gif;
+	return isDynamicImage(_imageInfo);
+}
+
+bool Paper::isDynamicImage(const ImageInfo& info)
+{
+	return info.format() == ImageFormat::gif || info.animated();
 }
 
 
@@ -270,6 +546,10 @@ void Paper::wheelEvent(QWheelEvent* event)
 	 */
 	int step = event->angleDelta().y() / 120;
 	if (QApplication::keyboardModifiers() == Qt::ControlModifier) {
+		/* Render fast while the wheel keeps turning, the image is refined
+		 * once it stops. */
+		_image->setPreview(true);
+		_refineTimer.start();
 		step > 0 ? zoomIn(0.1) : zoomOut(0.1);
 	} else {
 		emit (step > 0 ? toPrevPage() : toNextPage());
@@ -7,31 +7,110 @@
 #define PAPER_H
 
 #include <QWidget>
+#include <QHash>
 #include <QGridLayout>
 #include <QScrollArea>
 #include <QLabel>
+#include <QPixmap>
+#include <QSet>
+#include <QTimer>
 #include <opencv2/opencv.hpp>
 
+#include "animation_player.h"
+#include "decoder.h"
 #include "image_info.h"
-#include "lru_cache.h"
+#include "mipmap.h"
 
 namespace img_view {
 
-class AntialiasImage : public QWidget {
-	Q_DISABLE_COPY_MOVE(AntialiasImage)
+/*
+ * Show a static image in tiles, only the tiles intersecting the exposed area
+ * are scaled and kept, so the memory depends on the window size rather than
+ * the image size and the scale factor.
+ */
+class TiledImage : public QWidget {
+	Q_DISABLE_COPY_MOVE(TiledImage)
 
 public:
-	explicit AntialiasImage(QWidget* parent = nullptr) : QWidget(parent) {};
-	~AntialiasImage() = default;
+	explicit TiledImage(QWidget* parent = nullptr) : QWidget(parent)
+	{
+		/* The tiles cover the whole widget. */
+		setAttribute(Qt::WA_OpaquePaintEvent);
+	};
+	~TiledImage() = default;
+
+	/**
+	 * @brief Get the source image.
+	 */
+	const cv::Mat& image() const;
+
+	/**
+	 * @brief Set the source image, nothing changes if it is the current one.
+	 */
+	void setImage(const cv::Mat& image);
+
+	/**
+	 * @brief Get the scale factor relative to the source image.
+	 */
+	double scaleFactor() const;
 
-	const QImage& image() const;
-	void setImage(const QImage& image);
+	/**
+	 * @brief Set the scale factor relative to the source image, the widget is
+	 *        resized to the scaled image size.
+	 */
+	void setScaleFactor(const double& factor);
+
+	/**
+	 * @brief Enter or leave the preview mode.
+	 *
+	 * In the preview mode the tiles are scaled with a fast interpolation, it
+	 * is used while zooming continuously. The preview tiles are rendered
+	 * again in high quality when leaving the mode.
+	 */
+	void setPreview(bool preview);
 
 protected:
-	void paintEvent(QPaintEvent* ) override;
+	void paintEvent(QPaintEvent* event) override;
+
+private:
+	/**
+	 * @brief Get the key of the tile at column X and row Y.
+	 */
+	static quint64 tileKey(int x, int y);
+
+	/**
+	 * @brief Get the tile at column X and row Y, it is scaled from the
+	 *        nearest mipmap level when not cached.
+	 */
+	const QPixmap& tile(int x, int y);
+
+	/**
+	 * @brief Drop the tiles outside the visible area and its margin.
+	 */
+	void evictTiles();
+
+	/**
+	 * @brief Drop all tiles.
+	 */
+	void clearTiles();
+
+	/**
+	 * @brief Convert cv::Mat to QImage without copying the pixels, the QImage
+	 *        shares the buffer of SRC and keeps it alive.
+	 */
+	static QImage mat2Qimage(const cv::Mat& src);
 
 private:
-	QImage _image;
+	MipMap _mipmap;
+	double _factor = 1.0;
+	/* Tiles of the current scale factor, the key is (row << 32 | column). */
+	QHash<quint64, QPixmap> _tiles;
+	/* Keys of the tiles rendered in the preview mode. */
+	QSet<quint64> _previewTiles;
+	bool _preview = false;
+
+	/* Tile width and height in pixels. */
+	static constexpr int kTileSize = 256;
 };
 
 class Paper : public QWidget {
@@ -94,6 +173,12 @@ public:
 	 */
 	void limitToWindow();
 
+	/**
+	 * @brief Get the scale factor which limits the image INFO to the display
+	 *        area, see limitToWindow().
+	 */
+	double fitScaleFactor(const ImageInfo& info) const;
+
 	/**
 	 * @brief Move the image a distance (DX, DY) from the current position.
 	 *
@@ -102,6 +187,27 @@ public:
 	 */
 	void move(const double& dx, const double& dy);
 
+	/**
+	 * @brief Decode PAGES in background and put them into cache, so they can
+	 *        be drawn without waiting.
+	 *
+	 * The previous prefetch requests not in PAGES are cancelled.
+	 *
+	 * @param pages The pages to prefetch, the former ones are decoded first
+	 */
+	void prefetch(const QList<ImageInfo>& pages);
+
+	/**
+	 * @brief Cancel all prefetch requests.
+	 */
+	void cancelPrefetch();
+
+	/**
+	 * @brief Drop the cached and prefetching image of the page INFO, e.g.
+	 *        when the file has been removed or modified.
+	 */
+	void invalidate(const ImageInfo& info);
+
 	/**
 	 * @brief Get the supported MIME types
 	 *
@@ -113,6 +219,29 @@ signals:
 	void toPrevPage();
 	void toNextPage();
 
+private slots:
+	/**
+	 * @brief Receive the decoded image and show it if it is still the
+	 *        current image.
+	 */
+	void onDecoded(quint64 ticket, const ImageInfo& info,
+			const cv::Mat& image);
+
+	/**
+	 * @brief Apply the cache limit in options.
+	 */
+	void onCacheLimitChanged();
+
+	/**
+	 * @brief Render the image in high quality after zooming stopped.
+	 */
+	void onRefine();
+
+	/**
+	 * @brief Show the current FRAME of the animation.
+	 */
+	void onFrameChanged(const QImage& frame);
+
 private:
 	/**
 	 * @brief Adjust the scroll bar position according to the image size, keep
@@ -137,13 +266,28 @@ private:
 	 */
 	bool isDynamicImage() const;
 
+	/**
+	 * @brief Check if the image INFO is a dynamic image, that is a gif image
+	 *        or an animated webp or png image
+	 */
+	static bool isDynamicImage(const ImageInfo& info);
+
 	/**
 	 * @brief Draw a static image.
 	 *
+	 * If the image isn't in cache, it is decoded in background and the
+	 * previous image keeps shown until it is ready.
+	 *
 	 * @return True when succeeding.
 	 */
 	bool drawStaticImage();
 
+	/**
+	 * @brief Scale the decoded image SRC and show it, SRC may be decoded at a
+	 *        reduced size.
+	 */
+	void showStaticImage(const cv::Mat& src);
+
 	/**
 	 * @brief Draw a dynamic image.
 	 *
@@ -151,11 +295,6 @@ private:
 	 */
 	bool drawDynamicImage();
 
-	/**
-	 * @brief Convert cv::Mat to QImage.
-	 */
-	static QImage mat2Qimage(const cv::Mat& src);
-
 protected:
 	void wheelEvent(QWheelEvent* event) override;
 	void mousePressEvent(QMouseEvent* event) override;
@@ -167,12 +306,20 @@ private:
 	QScrollArea* _scrollArea = nullptr;
 
 	ImageInfo _imageInfo;
-	LruCache<ImageInfo, cv::Mat> _cache;
+	ImageCache _cache;
+	Decoder _decoder;
+	/* Ticket of decoding the current image, 0 if there is none. */
+	quint64 _decodeTicket = 0;
+	/* Tickets of prefetching, the key is the absolute path of the image. */
+	QHash<QString, quint64> _prefetchTickets;
 	QWidget* _container = nullptr;
-	AntialiasImage* _image = nullptr;
+	TiledImage* _image = nullptr;
 	QLabel* _movie = nullptr;
+	AnimationPlayer _player;
 
 	QPoint _mousePos;
+	/* Leave the preview mode when there is no zooming for a while. */
+	QTimer _refineTimer;
 
 	/* Initial scale factor of an image, it is 1.0 in general, but will be a
 	 * proper value to let the full image shown in the screen when the image
@@ -188,6 +335,14 @@ private:
 	static constexpr double kMaxScaleFactor = 3.0;
 	static constexpr double kMinScaleFactor = 0.5;
 
+	/* Decoding priority of the image to draw and the prefetched images. */
+	static constexpr int kDrawPriority = 10;
+	static constexpr int kPrefetchPriority = 0;
+
+	/* Idle time in milliseconds after zooming before rendering the image in
+	 * high quality. */
+	static constexpr int kRefineDelay = 150;
+
 	/* Supported MIME types. */
 	static const QList<QByteArray> kSupportedMineTypes;
 	/* Supported image format. */
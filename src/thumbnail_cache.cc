@@ -0,0 +1,237 @@
+/**
+ * thumbnail_cache.cc
+ *
+ * Created by vamirio on 2022 Oct 15
+ */
+#include "thumbnail_cache.h"
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include "debug.h"
+
+namespace img_view {
+
+ThumbnailCache::ThumbnailCache(qint64 maxBytes) : _maxBytes(maxBytes)
+{
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+	save();
+	unload();
+}
+
+void ThumbnailCache::open(const QString& path)
+{
+	save();
+	QMutexLocker locker(&_mutex);
+	unload();
+	_file.setFileName(path);
+	load();
+}
+
+QImage ThumbnailCache::get(const ImageInfo& info)
+{
+	QMutexLocker locker(&_mutex);
+	auto iter = _entries.find(keyOf(info));
+	if (iter == _entries.end() || iter->size != info.size()
+			|| iter->lastModified != info.lastModified())
+		return QImage();
+
+	iter->lastUsed = ++_clock;
+	_recencyChanged = true;
+	/* Copy the data, the file may be mapped again by save(). */
+	QByteArray data(dataOf(*iter), iter->length);
+	locker.unlock();
+	return QImage::fromData(data);
+}
+
+void ThumbnailCache::put(const ImageInfo& info, const QByteArray& data)
+{
+	Entry entry;
+	entry.key = keyOf(info);
+	entry.size = info.size();
+	entry.lastModified = info.lastModified();
+	entry.length = static_cast<quint32>(data.size());
+	entry.data = data;
+
+	QMutexLocker locker(&_mutex);
+	entry.lastUsed = ++_clock;
+	_entries.insert(entry.key, entry);
+	_dirty = true;
+}
+
+bool ThumbnailCache::save()
+{
+	QMutexLocker locker(&_mutex);
+	if (_file.fileName().isEmpty())
+		return true;
+	if (!_dirty)
+		return _recencyChanged ? saveRecency() : true;
+
+	/* Keep the most recently used entries within the max size. */
+	std::vector<const Entry*> entries;
+	for (const Entry& entry : _entries)
+		entries.push_back(&entry);
+	std::sort(entries.begin(), entries.end(),
+			[](const Entry* lhs, const Entry* rhs) {
+				return lhs->lastUsed > rhs->lastUsed;
+			});
+	qint64 bytes = kHeaderSize;
+	std::size_t count = 0;
+	for (; count != entries.size(); ++count) {
+		bytes += kEntrySize + entries[count]->length;
+		if (bytes > _maxBytes)
+			break;
+	}
+	entries.resize(count);
+
+	QDir().mkpath(QFileInfo(_file).absolutePath());
+	QSaveFile file(_file.fileName());
+	if (!file.open(QIODevice::WriteOnly)) {
+		gWarn() << "Failed to save thumbnails to" << _file.fileName();
+		return false;
+	}
+
+	QByteArray head(kHeaderSize + kEntrySize * entries.size(), '\0');
+	char* p = head.data();
+	qToLittleEndian<quint32>(kMagic, p);
+	qToLittleEndian<quint16>(kVersion, p + 4);
+	qToLittleEndian<quint32>(static_cast<quint32>(entries.size()), p + 8);
+	qToLittleEndian<quint32>(_clock, p + 12);
+	p += kHeaderSize;
+	quint64 offset = head.size();
+	for (const Entry* entry : entries) {
+		qToLittleEndian<quint64>(entry->key, p);
+		qToLittleEndian<qint64>(entry->size, p + 8);
+		qToLittleEndian<qint64>(entry->lastModified, p + 16);
+		qToLittleEndian<quint64>(offset, p + 24);
+		qToLittleEndian<quint32>(entry->length, p + 32);
+		qToLittleEndian<quint32>(entry->lastUsed, p + 36);
+		p += kEntrySize;
+		offset += entry->length;
+	}
+	file.write(head);
+	for (const Entry* entry : entries)
+		file.write(dataOf(*entry), entry->length);
+
+	/* The old file stays mapped until the new one replaces it. */
+	if (!file.commit()) {
+		gWarn() << "Failed to save thumbnails to" << _file.fileName();
+		return false;
+	}
+	gDebug() << "Saved" << entries.size() << "thumbnails," << offset
+		<< "bytes.";
+
+	unload();
+	load();
+	return true;
+}
+
+bool ThumbnailCache::saveRecency()
+{
+	/* No thumbnails were put, so the file is still within the max size,
+	 * patch the last used stamps in a copy of the header and the entry
+	 * table and write it back in place. */
+	if (!_map)
+		return true;
+	const char* map = reinterpret_cast<const char*>(_map);
+	quint32 count = qFromLittleEndian<quint32>(map + 8);
+	QByteArray head(map, kHeaderSize + static_cast<qint64>(kEntrySize) * count);
+	char* p = head.data();
+	qToLittleEndian<quint32>(_clock, p + 12);
+	for (const Entry& entry : _entries) {
+		qToLittleEndian<quint32>(entry.lastUsed,
+				p + kHeaderSize + kEntrySize * entry.slot + 36);
+	}
+
+	QFile file(_file.fileName());
+	if (!file.open(QIODevice::ReadWrite)
+			|| file.write(head) != head.size()) {
+		gWarn() << "Failed to save thumbnails to" << _file.fileName();
+		return false;
+	}
+	_recencyChanged = false;
+	return true;
+}
+
+void ThumbnailCache::load()
+{
+	_dirty = false;
+	_recencyChanged = false;
+	if (!_file.open(QIODevice::ReadOnly))
+		return;
+	_mapSize = _file.size();
+	if (_mapSize >= kHeaderSize)
+		_map = _file.map(0, _mapSize);
+	if (!_map) {
+		unload();
+		return;
+	}
+
+	const char* p = reinterpret_cast<const char*>(_map);
+	quint32 count = qFromLittleEndian<quint32>(p + 8);
+	if (qFromLittleEndian<quint32>(p) != kMagic
+			|| qFromLittleEndian<quint16>(p + 4) != kVersion
+			|| kHeaderSize + static_cast<qint64>(kEntrySize) * count
+				> _mapSize) {
+		gWarn() << "Ignore the broken thumbnail cache" << _file.fileName();
+		unload();
+		return;
+	}
+	_clock = qFromLittleEndian<quint32>(p + 12);
+
+	p += kHeaderSize;
+	_entries.reserve(count);
+	for (quint32 i = 0; i != count; ++i, p += kEntrySize) {
+		Entry entry;
+		entry.key = qFromLittleEndian<quint64>(p);
+		entry.size = qFromLittleEndian<qint64>(p + 8);
+		entry.lastModified = qFromLittleEndian<qint64>(p + 16);
+		entry.offset = qFromLittleEndian<quint64>(p + 24);
+		entry.length = qFromLittleEndian<quint32>(p + 32);
+		entry.lastUsed = qFromLittleEndian<quint32>(p + 36);
+		entry.slot = i;
+		if (entry.offset > static_cast<quint64>(_mapSize)
+				|| entry.length > _mapSize - entry.offset)
+			continue;
+		_entries.insert(entry.key, entry);
+	}
+}
+
+void ThumbnailCache::unload()
+{
+	if (_map)
+		_file.unmap(_map);
+	_map = nullptr;
+	_mapSize = 0;
+	_file.close();
+	_entries.clear();
+}
+
+const char* ThumbnailCache::dataOf(const Entry& entry) const
+{
+	if (!entry.data.isNull())
+		return entry.data.constData();
+	return reinterpret_cast<const char*>(_map) + entry.offset;
+}
+
+quint64 ThumbnailCache::keyOf(const ImageInfo& info)
+{
+	/* FNV-1a, qHash() is seeded differently in every run. */
+	quint64 hash = 14695981039346656037ULL;
+	for (char c : info.pathKey()) {
+		hash ^= static_cast<uchar>(c);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+}  /* img_view */
@@ -0,0 +1,137 @@
+/**
+ * thumbnail_cache.h
+ *
+ * Persistent thumbnail cache, all thumbnails are packed in a single file
+ * which is memory mapped when reading.
+ *
+ * The file is a header, an entry table and the encoded thumbnails, all
+ * numbers are little endian:
+ *
+ *     magic (4) | version (2) | reserved (2) | count (4) | clock (4)
+ *     count * { key (8) | size (8) | last modified (8) | offset (8) |
+ *               length (4) | last used (4) }
+ *     thumbnails
+ *
+ * Created by vamirio on 2022 Oct 15
+ */
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+
+#include "image_info.h"
+
+namespace img_view {
+
+class ThumbnailCache {
+public:
+	/**
+	 * @param maxBytes Max size of the cache file
+	 */
+	explicit ThumbnailCache(qint64 maxBytes = kDefaultMaxBytes);
+	~ThumbnailCache();
+
+	ThumbnailCache(const ThumbnailCache&) = delete;
+	ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+	/**
+	 * @brief Save the current cache file and map PATH, a missing or broken
+	 *        file is regarded as an empty cache.
+	 */
+	void open(const QString& path);
+
+	/**
+	 * @brief Get the thumbnail of INFO, it is thread-safe.
+	 *
+	 * @return The thumbnail, or a null image when there is none or the image
+	 *         has been modified since the thumbnail was made
+	 */
+	QImage get(const ImageInfo& info);
+
+	/**
+	 * @brief Put the encoded thumbnail DATA of INFO into the cache, it is
+	 *        written to the file by save(). It is thread-safe.
+	 */
+	void put(const ImageInfo& info, const QByteArray& data);
+
+	/**
+	 * @brief Write the cache file again if thumbnails were put, the least
+	 *        recently used ones are dropped to keep the file within the max
+	 *        size. When thumbnails were only got, just the last used stamps
+	 *        in the entry table are updated.
+	 *
+	 * @return False when failed to write the file
+	 */
+	bool save();
+
+private:
+	struct Entry {
+		quint64 key = 0;
+		qint64 size = 0;
+		qint64 lastModified = 0;
+		quint64 offset = 0;
+		quint32 length = 0;
+		quint32 lastUsed = 0;
+		/* Position in the entry table of the file. */
+		quint32 slot = 0;
+		/* Data of the thumbnails not saved yet. */
+		QByteArray data;
+	};
+
+	/**
+	 * @brief Write the last used stamps to the entry table of the cache file
+	 *        in place, called with the lock held.
+	 *
+	 * @return False when failed to write the file
+	 */
+	bool saveRecency();
+
+	/**
+	 * @brief Map the cache file and read its entry table.
+	 */
+	void load();
+
+	/**
+	 * @brief Unmap and close the cache file.
+	 */
+	void unload();
+
+	/**
+	 * @brief Get the data of ENTRY.
+	 */
+	const char* dataOf(const Entry& entry) const;
+
+	/**
+	 * @brief Get the stable key of INFO, the hash of its path.
+	 */
+	static quint64 keyOf(const ImageInfo& info);
+
+private:
+	QMutex _mutex;
+	QFile _file;
+	uchar* _map = nullptr;
+	qint64 _mapSize = 0;
+	QHash<quint64, Entry> _entries;
+	/* Increased on every use, the least recently used entry has the least
+	 * lastUsed. */
+	quint32 _clock = 0;
+	qint64 _maxBytes;
+	bool _dirty = false;
+	/* Thumbnails were got since the file was loaded. */
+	bool _recencyChanged = false;
+
+	static constexpr quint32 kMagic = 0x43545649;  /* "IVTC" */
+	static constexpr quint16 kVersion = 2;
+	static constexpr int kHeaderSize = 16;
+	static constexpr int kEntrySize = 40;
+	static constexpr qint64 kDefaultMaxBytes = 256 << 20;
+};
+
+}  /* img_view */
+
+#endif /* ifndef THUMBNAIL_CACHE_H */
@@ -0,0 +1,102 @@
+/**
+ * thumbnailer.cc
+ *
+ * Created by vamirio on 2022 Oct 15
+ */
+#include "thumbnailer.h"
+
+#include <cstdlib>
+
+#include <QBuffer>
+#include <QImageReader>
+#include <QStandardPaths>
+
+#include "debug.h"
+
+namespace img_view {
+
+Thumbnailer::Thumbnailer(QObject* parent) : QObject(parent)
+{
+	_cache.open(QStandardPaths::writableLocation(
+				QStandardPaths::CacheLocation) + "/thumbnails.cache");
+}
+
+Thumbnailer::~Thumbnailer()
+{
+	cancel();
+}
+
+void Thumbnailer::request(const QList<ImageInfo>& pages, int current)
+{
+	_pool.clear();
+	int generation = ++_generation;
+	for (int i = 0; i != pages.size(); ++i) {
+		const ImageInfo& info = pages.at(i);
+		_pool.start([this, generation, info]() { run(generation, info); },
+				-std::abs(i - current));
+	}
+}
+
+void Thumbnailer::cancel()
+{
+	++_generation;
+	_pool.clear();
+	_pool.waitForDone();
+	_cache.save();
+}
+
+void Thumbnailer::run(int generation, const ImageInfo& info)
+{
+	if (generation != _generation)
+		return;
+
+	QImage thumbnail = _cache.get(info);
+	if (thumbnail.isNull()) {
+		thumbnail = make(info);
+		if (thumbnail.isNull())
+			return;
+
+		/* Keep the alpha channel in PNG, the others in JPEG. */
+		QByteArray data;
+		QBuffer buf(&data);
+		buf.open(QIODevice::WriteOnly);
+		if (thumbnail.hasAlphaChannel())
+			thumbnail.save(&buf, "PNG");
+		else
+			thumbnail.save(&buf, "JPG", 85);
+		_cache.put(info, data);
+	}
+
+	QMetaObject::invokeMethod(this, [this, generation, info, thumbnail]() {
+				if (generation == _generation)
+					emit thumbnailReady(info, thumbnail);
+			}, Qt::QueuedConnection);
+}
+
+QImage Thumbnailer::make(const ImageInfo& info)
+{
+	std::unique_ptr<QIODevice> dev = info.open();
+	if (!dev)
+		return QImage();
+	QImage thumbnail = read(dev.get());
+	if (thumbnail.isNull())
+		gWarn() << "Failed to make the thumbnail of" << info.filename();
+	return thumbnail;
+}
+
+QImage Thumbnailer::read(QIODevice* dev)
+{
+	/* The JPEG reader skips the unneeded DCT work with a scaled size. It is
+	 * applied before the EXIF rotation, so take it from the size stored
+	 * rather than ImageInfo::dimensions(). */
+	QImageReader reader(dev);
+	reader.setAutoTransform(true);
+	QSize size = reader.size();
+	if (size.width() > kThumbnailSize || size.height() > kThumbnailSize) {
+		reader.setScaledSize(size.scaled(kThumbnailSize, kThumbnailSize,
+					Qt::KeepAspectRatio));
+	}
+	return reader.read();
+}
+
+}  /* img_view */
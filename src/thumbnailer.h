@@ -0,0 +1,86 @@
+/**
+ * thumbnailer.h
+ *
+ * Make thumbnails of the pages in background and keep them in the thumbnail
+ * cache, so they are made only once.
+ *
+ * Created by vamirio on 2022 Oct 15
+ */
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <atomic>
+
+#include <QObject>
+#include <QImage>
+#include <QList>
+#include <QThreadPool>
+
+#include "image_info.h"
+#include "thumbnail_cache.h"
+
+namespace img_view {
+
+class Thumbnailer : public QObject {
+	Q_OBJECT
+
+public:
+	explicit Thumbnailer(QObject* parent = nullptr);
+	~Thumbnailer();
+
+	/**
+	 * @brief Get the thumbnails of PAGES in background, the ones not in the
+	 *        cache are made from the images. The previous requests are
+	 *        cancelled.
+	 *
+	 * @param pages The pages to get thumbnails of
+	 * @param current The index of the page whose neighbours are done first
+	 */
+	void request(const QList<ImageInfo>& pages, int current = 0);
+
+	/**
+	 * @brief Cancel the requests, wait for the running ones and save the new
+	 *        thumbnails.
+	 */
+	void cancel();
+
+signals:
+	/**
+	 * @brief Emitted in the thread of the thumbnailer when the thumbnail of
+	 *        INFO is ready.
+	 */
+	void thumbnailReady(const ImageInfo& info, const QImage& thumbnail);
+
+private:
+	/**
+	 * @brief Get the thumbnail of INFO, run in the worker threads.
+	 */
+	void run(int generation, const ImageInfo& info);
+
+	/**
+	 * @brief Scale the image INFO down to a thumbnail while decoding.
+	 */
+	static QImage make(const ImageInfo& info);
+
+public:
+	/**
+	 * @brief Decode the image in DEV scaled down to fit in kThumbnailSize,
+	 *        the EXIF orientation is applied.
+	 *
+	 * @return The null image when failed
+	 */
+	static QImage read(QIODevice* dev);
+
+	/* Max width and height of the thumbnails. */
+	static constexpr int kThumbnailSize = 256;
+
+private:
+	ThumbnailCache _cache;
+	QThreadPool _pool;
+	/* Increase on every request to drop the results of the cancelled ones. */
+	std::atomic<int> _generation = 0;
+};
+
+}  /* img_view */
+
+#endif /* ifndef THUMBNAILER_H */
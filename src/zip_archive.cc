@@ -0,0 +1,315 @@
+/**
+ * zip_archive.cc
+ *
+ * Created by vamirio on 2022 Oct 22
+ */
+#include "zip_archive.h"
+
+#include <algorithm>
+#include <climits>
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutex>
+#include <QtEndian>
+#include <zlib.h>
+
+#include "debug.h"
+
+namespace img_view {
+
+/* Signatures of the ZIP records. */
+static constexpr quint32 kLocalHeader = 0x04034B50;
+static constexpr quint32 kCentralHeader = 0x02014B50;
+static constexpr quint32 kEndOfCentralDir = 0x06054B50;
+static constexpr quint32 kZip64EndOfCentralDir = 0x06064B50;
+static constexpr quint32 kZip64Locator = 0x07064B50;
+
+/* Fixed sizes of the records. */
+static constexpr qint64 kLocalHeaderSize = 30;
+static constexpr qint64 kCentralHeaderSize = 46;
+static constexpr qint64 kEndOfCentralDirSize = 22;
+static constexpr qint64 kZip64EndOfCentralDirSize = 56;
+static constexpr qint64 kZip64LocatorSize = 20;
+
+static quint16 le16(const uchar* p)
+{
+	return qFromLittleEndian<quint16>(p);
+}
+
+static quint32 le32(const uchar* p)
+{
+	return qFromLittleEndian<quint32>(p);
+}
+
+static quint64 le64(const uchar* p)
+{
+	return qFromLittleEndian<quint64>(p);
+}
+
+/* Convert the MS-DOS date and time to milliseconds since the epoch. */
+static qint64 dosTime(quint16 date, quint16 time)
+{
+	QDateTime datetime(QDate(1980 + (date >> 9), (date >> 5) & 0xF, date & 0x1F),
+			QTime(time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2));
+	return datetime.isValid() ? datetime.toMSecsSinceEpoch() : 0;
+}
+
+/*
+ * A buffer over the data of a member, the data of the stored members refers
+ * to the mapped archive, so the archive is kept alive with the buffer.
+ */
+class MemberBuffer : public QBuffer {
+public:
+	MemberBuffer(std::shared_ptr<const ZipArchive> archive,
+			const QByteArray& data) : _archive(std::move(archive)), _data(data)
+	{
+		setBuffer(&_data);
+	}
+
+private:
+	std::shared_ptr<const ZipArchive> _archive;
+	QByteArray _data;
+};
+
+ZipArchive::~ZipArchive()
+{
+	if (_map)
+		_file.unmap(const_cast<uchar*>(_map));
+}
+
+std::shared_ptr<ZipArchive> ZipArchive::open(const QString& path)
+{
+	static QMutex mutex;
+	static QHash<QString, std::weak_ptr<ZipArchive>> archives;
+
+	QFileInfo info(path);
+	QString key = info.canonicalFilePath();
+	if (key.isEmpty())
+		return nullptr;
+
+	QMutexLocker locker(&mutex);
+	std::shared_ptr<ZipArchive> archive = archives.value(key).lock();
+	if (archive && archive->_mapSize == info.size()
+			&& archive->_lastModified
+				== info.lastModified().toMSecsSinceEpoch())
+		return archive;
+
+	archive = std::make_shared<ZipArchive>();
+	if (!archive->load(key))
+		return nullptr;
+
+	archives.removeIf([](const auto& iter) { return iter.value().expired(); });
+	archives.insert(key, archive);
+	return archive;
+}
+
+bool ZipArchive::isArchive(const QString& path)
+{
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+	QByteArray magic = file.read(4);
+	/* A local file header, or the end record of an empty archive. */
+	return magic == QByteArray("PK\x03\x04", 4)
+		|| magic == QByteArray("PK\x05\x06", 4);
+}
+
+const QString& ZipArchive::path() const
+{
+	return _path;
+}
+
+const QList<ZipArchive::Entry>& ZipArchive::entries() const
+{
+	return _entries;
+}
+
+QStringList ZipArchive::names() const
+{
+	QStringList names;
+	names.reserve(_entries.size());
+	for (const Entry& entry : _entries)
+		names.append(entry.name);
+	names.sort();
+	return names;
+}
+
+int ZipArchive::find(const QString& name) const
+{
+	return _names.value(name, -1);
+}
+
+bool ZipArchive::load(const QString& path)
+{
+	_path = path;
+	_file.setFileName(path);
+	if (!_file.open(QIODevice::ReadOnly))
+		return false;
+	_mapSize = _file.size();
+	_lastModified = QFileInfo(_file).lastModified().toMSecsSinceEpoch();
+	if (_mapSize < kEndOfCentralDirSize)
+		return false;
+	_map = _file.map(0, _mapSize);
+	if (!_map) {
+		gWarn() << "Failed to map" << path;
+		return false;
+	}
+
+	/* The end of central directory record is followed by a comment of at
+	 * most 65535 bytes. */
+	qint64 eocd = _mapSize - kEndOfCentralDirSize;
+	qint64 stop = std::max<qint64>(0, eocd - 0xFFFF);
+	while (eocd >= stop && le32(_map + eocd) != kEndOfCentralDir)
+		--eocd;
+	if (eocd < stop) {
+		gWarn() << "No central directory in" << path;
+		return false;
+	}
+
+	quint64 count = le16(_map + eocd + 10);
+	quint64 cdSize = le32(_map + eocd + 12);
+	quint64 cdOffset = le32(_map + eocd + 16);
+	/* Large archives keep the numbers in the ZIP64 record. */
+	qint64 locator = eocd - kZip64LocatorSize;
+	if (locator >= 0 && le32(_map + locator) == kZip64Locator) {
+		quint64 offset = le64(_map + locator + 8);
+		if (offset <= static_cast<quint64>(_mapSize
+					- kZip64EndOfCentralDirSize)
+				&& le32(_map + offset) == kZip64EndOfCentralDir) {
+			count = le64(_map + offset + 32);
+			cdSize = le64(_map + offset + 40);
+			cdOffset = le64(_map + offset + 48);
+		}
+	}
+	if (cdOffset > static_cast<quint64>(_mapSize)
+			|| cdSize > _mapSize - cdOffset) {
+		gWarn() << "Broken central directory in" << path;
+		return false;
+	}
+
+	const uchar* p = _map + cdOffset;
+	const uchar* end = p + cdSize;
+	for (quint64 i = 0; i != count; ++i) {
+		if (end - p < kCentralHeaderSize || le32(p) != kCentralHeader)
+			break;
+		quint16 flags = le16(p + 8);
+		quint16 nameLen = le16(p + 28);
+		quint16 extraLen = le16(p + 30);
+		quint16 commentLen = le16(p + 32);
+		const uchar* name = p + kCentralHeaderSize;
+		const uchar* next = name + nameLen + extraLen + commentLen;
+		if (next > end)
+			break;
+
+		Entry entry;
+		entry.method = le16(p + 10);
+		entry.lastModified = dosTime(le16(p + 14), le16(p + 12));
+		entry.compressedSize = le32(p + 20);
+		entry.size = le32(p + 24);
+		entry.localOffset = le32(p + 42);
+		/* Archivers without the UTF-8 flag use the code page of the
+		 * system. */
+		const char* raw = reinterpret_cast<const char*>(name);
+		entry.name = flags & 0x800 ? QString::fromUtf8(raw, nameLen)
+			: QString::fromLocal8Bit(raw, nameLen);
+
+		/* The ZIP64 extra field holds the numbers which are 0xFFFFFFFF in
+		 * order. */
+		for (const uchar* extra = name + nameLen;
+				extra + 4 <= name + nameLen + extraLen; ) {
+			quint16 id = le16(extra);
+			quint16 len = le16(extra + 2);
+			const uchar* field = extra + 4;
+			const uchar* fieldEnd = field + len;
+			if (fieldEnd > name + nameLen + extraLen)
+				break;
+			if (id == 0x0001) {
+				if (entry.size == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+					entry.size = le64(field);
+					field += 8;
+				}
+				if (entry.compressedSize == 0xFFFFFFFF
+						&& field + 8 <= fieldEnd) {
+					entry.compressedSize = le64(field);
+					field += 8;
+				}
+				if (entry.localOffset == 0xFFFFFFFF && field + 8 <= fieldEnd)
+					entry.localOffset = le64(field);
+			}
+			extra = fieldEnd;
+		}
+		p = next;
+
+		/* Skip the directories, the encrypted files and the unsupported
+		 * compression methods. */
+		if (entry.name.endsWith('/') || (flags & 0x1)
+				|| (entry.method != 0 && entry.method != 8))
+			continue;
+		_names.insert(entry.name, _entries.size());
+		_entries.append(entry);
+	}
+
+	gDebug() << "Archive" << path << "has" << _entries.size() << "files.";
+	return true;
+}
+
+QByteArray ZipArchive::read(int index, qint64 limit) const
+{
+	if (index < 0 || index >= _entries.size())
+		return QByteArray();
+	const Entry& entry = _entries.at(index);
+
+	/* The local header has its own name and extra field lengths. */
+	if (entry.localOffset > static_cast<quint64>(_mapSize - kLocalHeaderSize)
+			|| le32(_map + entry.localOffset) != kLocalHeader)
+		return QByteArray();
+	const uchar* local = _map + entry.localOffset;
+	quint64 offset = entry.localOffset + kLocalHeaderSize + le16(local + 26)
+		+ le16(local + 28);
+	if (offset > static_cast<quint64>(_mapSize)
+			|| entry.compressedSize > _mapSize - offset)
+		return QByteArray();
+	const uchar* data = _map + offset;
+
+	quint64 size = limit < 0 ? entry.size
+		: std::min<quint64>(entry.size, limit);
+	if (entry.method == 0) {
+		return QByteArray::fromRawData(reinterpret_cast<const char*>(data),
+				std::min(size, entry.compressedSize));
+	}
+
+	if (size > UINT_MAX || entry.compressedSize > UINT_MAX)
+		return QByteArray();
+	QByteArray ret(size, Qt::Uninitialized);
+	z_stream stream = {};
+	/* Raw deflate data without the zlib header. */
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return QByteArray();
+	stream.next_in = const_cast<Bytef*>(data);
+	stream.avail_in = static_cast<uInt>(entry.compressedSize);
+	stream.next_out = reinterpret_cast<Bytef*>(ret.data());
+	stream.avail_out = static_cast<uInt>(size);
+	int status = Z_OK;
+	while (status == Z_OK && stream.avail_out != 0)
+		status = inflate(&stream, Z_NO_FLUSH);
+	ret.resize(stream.total_out);
+	inflateEnd(&stream);
+
+	if (status != Z_OK && status != Z_STREAM_END) {
+		gWarn() << "Failed to inflate" << entry.name << "in" << _path;
+		return QByteArray();
+	}
+	return ret;
+}
+
+std::unique_ptr<QIODevice> ZipArchive::device(int index) const
+{
+	QByteArray data = read(index);
+	if (data.isNull())
+		return nullptr;
+	return std::make_unique<MemberBuffer>(shared_from_this(), data);
+}
+
+}  /* img_view */
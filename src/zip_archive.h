@@ -0,0 +1,118 @@
+/**
+ * zip_archive.h
+ *
+ * Read the members of ZIP (CBZ) archives without extracting them, the archive
+ * is memory mapped and only the central directory is parsed when opening.
+ *
+ * Created by vamirio on 2022 Oct 22
+ */
+#ifndef ZIP_ARCHIVE_H
+#define ZIP_ARCHIVE_H
+
+#include <memory>
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+namespace img_view {
+
+class ZipArchive : public std::enable_shared_from_this<ZipArchive> {
+public:
+	struct Entry {
+		QString name;              /* Path of the member in the archive. */
+		quint64 localOffset = 0;   /* Offset of the local file header. */
+		quint64 compressedSize = 0;
+		quint64 size = 0;          /* Uncompressed size. */
+		quint16 method = 0;        /* 0: stored, 8: deflated. */
+		qint64 lastModified = 0;   /* Milliseconds since the epoch. */
+	};
+
+public:
+	ZipArchive() = default;
+	~ZipArchive();
+
+	ZipArchive(const ZipArchive&) = delete;
+	ZipArchive& operator=(const ZipArchive&) = delete;
+
+	/**
+	 * @brief Get the opened archive PATH, it is shared with the other users
+	 *        of the same archive as long as the archive is unchanged.
+	 *
+	 * @return The archive, or nullptr when PATH is not a readable archive
+	 */
+	static std::shared_ptr<ZipArchive> open(const QString& path);
+
+	/**
+	 * @brief Check if the file PATH is a ZIP archive by its magic number.
+	 */
+	static bool isArchive(const QString& path);
+
+	/**
+	 * @brief Get the absolute path of the archive.
+	 */
+	const QString& path() const;
+
+	/**
+	 * @brief Get the files in the archive, the directories, the encrypted
+	 *        files and the files in unsupported methods are excluded.
+	 */
+	const QList<Entry>& entries() const;
+
+	/**
+	 * @brief Get the names of the entries in ascending order.
+	 */
+	QStringList names() const;
+
+	/**
+	 * @brief Get the index of the member NAME in entries().
+	 *
+	 * @return The index, or -1 when not found
+	 */
+	int find(const QString& name) const;
+
+	/**
+	 * @brief Read the member INDEX, it is thread-safe.
+	 *
+	 * @param index The index of the member in entries()
+	 * @param limit Read at most LIMIT bytes from the beginning, -1 for the
+	 *        whole member
+	 *
+	 * @return The data, stored members refer to the mapped archive without
+	 *         copying, so they must not outlive the archive. It is empty when
+	 *         the member is broken.
+	 */
+	QByteArray read(int index, qint64 limit = -1) const;
+
+	/**
+	 * @brief Get a device reading the member INDEX, it keeps the archive
+	 *        alive and is not opened yet.
+	 *
+	 * @return The device, or nullptr when the member is broken
+	 */
+	std::unique_ptr<QIODevice> device(int index) const;
+
+private:
+	/**
+	 * @brief Map PATH and parse its central directory.
+	 */
+	bool load(const QString& path);
+
+private:
+	QString _path;
+	QFile _file;
+	const uchar* _map = nullptr;
+	qint64 _mapSize = 0;
+	/* To check if the archive is changed since opened. */
+	qint64 _lastModified = 0;
+	QList<Entry> _entries;
+	QHash<QString, int> _names;
+};
+
+}  /* img_view */
+
+#endif /* ifndef ZIP_ARCHIVE_H */
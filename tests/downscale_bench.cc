@@ -0,0 +1,76 @@
+/**
+ * downscale_bench.cc
+ *
+ * Time every row kernel of downscaleArea() and cv::resize() with
+ * cv::INTER_AREA on photo sized images.
+ *
+ * Created by vamirio on 2022 Nov 27
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "downscale.h"
+
+using namespace img_view;
+
+static constexpr int kRuns = 9;
+
+/**
+ * @brief Run FUNC kRuns times.
+ *
+ * @return The median time in milliseconds
+ */
+static double timeIt(const std::function<void()>& func)
+{
+	std::vector<double> times;
+	for (int i = 0; i < kRuns; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double, std::milli> time =
+			std::chrono::steady_clock::now() - start;
+		times.push_back(time.count());
+	}
+	std::nth_element(times.begin(), times.begin() + kRuns / 2, times.end());
+	return times[kRuns / 2];
+}
+
+static void bench(const cv::Mat& src, const cv::Size& size)
+{
+	printf("%dx%d -> %dx%d:\n", src.cols, src.rows, size.width, size.height);
+	cv::Mat dst;
+	double base = timeIt([&]() {
+				cv::resize(src, dst, size, 0, 0, cv::INTER_AREA);
+			});
+	printf("  %-10s %8.2f ms\n", "cv::resize", base);
+	for (const char* kernels : { "scalar", "sse4.1", "avx2" }) {
+		if (!setDownscaleKernels(kernels))
+			continue;
+		double time = timeIt([&]() { downscaleArea(src, dst, size); });
+		printf("  %-10s %8.2f ms  %5.2fx\n", kernels, time, base / time);
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1);
+	cv::Mat src(cv::Size(4000, 3000), CV_8UC3);
+	for (int y = 0; y < src.rows; ++y) {
+		uchar* p = src.ptr<uchar>(y);
+		for (int i = 0; i < src.cols * 3; ++i)
+			p[i] = static_cast<uchar>(rng());
+	}
+
+	/* The mipmap levels, then fitting the window. */
+	bench(src, cv::Size(2000, 1500));
+	bench(src, cv::Size(1000, 750));
+	bench(src, cv::Size(500, 375));
+	bench(src, cv::Size(1920, 1440));
+	bench(src, cv::Size(1333, 1000));
+	return 0;
+}
@@ -0,0 +1,115 @@
+/**
+ * downscale_test.cc
+ *
+ * Check every row kernel of downscaleArea() against cv::resize() with
+ * cv::INTER_AREA.
+ *
+ * Created by vamirio on 2022 Nov 27
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <opencv2/opencv.hpp>
+
+#include "downscale.h"
+
+using namespace img_view;
+
+static int failures = 0;
+
+/**
+ * @brief Make a WIDTH x HEIGHT BGR888 image of random pixels, with the first
+ *        rows saturated to catch overflows of the block sums.
+ */
+static cv::Mat makeImage(int width, int height, unsigned seed)
+{
+	std::mt19937 rng(seed);
+	cv::Mat image(cv::Size(width, height), CV_8UC3);
+	for (int y = 0; y < height; ++y) {
+		uchar* p = image.ptr<uchar>(y);
+		for (int i = 0; i < width * 3; ++i)
+			p[i] = y < height / 4 ? 255 : static_cast<uchar>(rng());
+	}
+	return image;
+}
+
+/**
+ * @brief Downscale a WIDTH x HEIGHT image to DST_WIDTH x DST_HEIGHT, the
+ *        result may differ from cv::resize() by 1 for rounding.
+ */
+static void checkDownscale(const char* kernels, int width, int height,
+		int dstWidth, int dstHeight)
+{
+	cv::Mat src = makeImage(width, height, width * 31 + height);
+	cv::Size size(dstWidth, dstHeight);
+	cv::Mat expected;
+	cv::resize(src, expected, size, 0, 0, cv::INTER_AREA);
+	cv::Mat dst;
+	downscaleArea(src, dst, size);
+
+	int maxDiff = 0;
+	for (int y = 0; y < dstHeight; ++y) {
+		const uchar* p = dst.ptr<uchar>(y);
+		const uchar* q = expected.ptr<uchar>(y);
+		for (int i = 0; i < dstWidth * 3; ++i)
+			maxDiff = std::max(maxDiff, std::abs(p[i] - q[i]));
+	}
+	if (dst.size() != size || maxDiff > 1) {
+		fprintf(stderr, "FAILED: %s kernels, %dx%d -> %dx%d differs by %d\n",
+				kernels, width, height, dstWidth, dstHeight, maxDiff);
+		++failures;
+	}
+}
+
+static void testKernels(const char* kernels)
+{
+	/* Integer blocks, the sizes of the mipmap levels first. */
+	checkDownscale(kernels, 640, 480, 320, 240);
+	checkDownscale(kernels, 333, 111, 111, 37);
+	checkDownscale(kernels, 35, 49, 5, 7);
+	checkDownscale(kernels, 101, 97, 101, 1);
+	checkDownscale(kernels, 101, 97, 1, 97);
+	checkDownscale(kernels, 7, 5, 1, 1);
+	/* Blocks of 256 pixels or just below, the largest summed in 16 bits. */
+	checkDownscale(kernels, 16 * 13, 16 * 7, 13, 7);
+	checkDownscale(kernels, 15 * 9, 17 * 11, 9, 11);
+	checkDownscale(kernels, 5 * 21, 51 * 3, 21, 3);
+	checkDownscale(kernels, 255 * 2, 3, 2, 3);
+	/* Blocks over 256 pixels fall back to the fractional path. */
+	checkDownscale(kernels, 16 * 9, 17 * 5, 9, 5);
+	checkDownscale(kernels, 257, 3, 1, 3);
+
+	/* Fractional areas. */
+	checkDownscale(kernels, 1000, 750, 333, 250);
+	checkDownscale(kernels, 101, 99, 37, 41);
+	checkDownscale(kernels, 7, 5, 3, 2);
+	checkDownscale(kernels, 640, 480, 639, 479);
+	checkDownscale(kernels, 640, 480, 320, 241);
+	checkDownscale(kernels, 3, 1000, 2, 7);
+
+	/* Downscaling in place. */
+	cv::Mat image = makeImage(64, 48, 1);
+	cv::Mat expected;
+	cv::resize(image, expected, cv::Size(21, 16), 0, 0, cv::INTER_AREA);
+	downscaleArea(image, image, cv::Size(21, 16));
+	if (image.size() != expected.size()) {
+		fprintf(stderr, "FAILED: %s kernels, downscaling in place\n",
+				kernels);
+		++failures;
+	}
+}
+
+int main()
+{
+	for (const char* kernels : { "scalar", "sse4.1", "avx2" }) {
+		if (!setDownscaleKernels(kernels)) {
+			printf("Skip the %s kernels, not supported.\n", kernels);
+			continue;
+		}
+		testKernels(kernels);
+	}
+	if (failures == 0)
+		printf("All downscale tests passed.\n");
+	return failures == 0 ? 0 : 1;
+}
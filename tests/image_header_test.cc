@@ -0,0 +1,300 @@
+/**
+ * image_header_test.cc
+ *
+ * Check the image header parsers with handmade headers.
+ *
+ * Created by vamirio on 2022 Nov 26
+ */
+#include <cstdio>
+#include <string>
+
+#include "image_header.h"
+
+using namespace img_view;
+
+static int failures = 0;
+
+static void check(bool cond, const char* what)
+{
+	if (!cond) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+/**
+ * @brief Make a jpeg header of a WIDTH x HEIGHT image, with an EXIF segment
+ *        when ORIENTATION is not 0.
+ *
+ * @param le Write the EXIF data in little endian ("II") or big endian ("MM")
+ */
+static std::string makeJpeg(int width, int height, int orientation, bool le)
+{
+	auto u16 = [le](int v) {
+		char b[2] = { static_cast<char>(v & 0xFF), static_cast<char>(v >> 8) };
+		return le ? std::string(b, 2) : std::string{ b[1], b[0] };
+	};
+	auto u32 = [&u16, le](int v) {
+		return le ? u16(v & 0xFFFF) + u16(v >> 16)
+			: u16(v >> 16) + u16(v & 0xFFFF);
+	};
+	auto be16 = [](int v) {
+		return std::string{ static_cast<char>(v >> 8),
+			static_cast<char>(v & 0xFF) };
+	};
+
+	std::string jpeg("\xFF\xD8", 2);
+	if (orientation != 0) {
+		/* TIFF header + IFD0 with an unrelated tag and the orientation. */
+		std::string tiff = (le ? "II" : "MM") + u16(42) + u32(8) + u16(2)
+			+ u16(0x010F) + u16(2) + u32(4) + u32(0)
+			+ u16(0x0112) + u16(3) + u32(1) + u16(orientation) + u16(0)
+			+ u32(0);
+		std::string exif = std::string("Exif\0\0", 6) + tiff;
+		jpeg += "\xFF\xE1" + be16(static_cast<int>(exif.size()) + 2) + exif;
+	}
+	/* SOF0 of an 8-bit YCbCr image. */
+	jpeg += "\xFF\xC0" + be16(17) + '\x08' + be16(height) + be16(width)
+		+ '\x03' + std::string(9, '\0');
+	return jpeg;
+}
+
+/**
+ * @brief The N lowest bytes of V in little endian.
+ */
+static std::string le(quint32 v, int n)
+{
+	std::string bytes;
+	for (int i = 0; i != n; ++i)
+		bytes += static_cast<char>((v >> (i * 8)) & 0xFF);
+	return bytes;
+}
+
+/**
+ * @brief The N lowest bytes of V in big endian.
+ */
+static std::string be(quint32 v, int n)
+{
+	std::string bytes = le(v, n);
+	return std::string(bytes.rbegin(), bytes.rend());
+}
+
+static std::string makeBmpInfo(int width, int height, int depth)
+{
+	/* File header + the start of BITMAPINFOHEADER. */
+	return "BM" + std::string(12, '\0') + le(40, 4) + le(width, 4)
+		+ le(height, 4) + le(1, 2) + le(depth, 2);
+}
+
+static std::string makeBmpCore(int width, int height, int depth)
+{
+	/* File header + BITMAPCOREHEADER. */
+	return "BM" + std::string(12, '\0') + le(12, 4) + le(width, 2)
+		+ le(height, 2) + le(1, 2) + le(depth, 2);
+}
+
+static std::string makeGif(int width, int height, int packed)
+{
+	return "GIF89a" + le(width, 2) + le(height, 2)
+		+ static_cast<char>(packed) + std::string(2, '\0');
+}
+
+/**
+ * @brief Make a png header up to the type of the first IDAT chunk, or up to
+ *        the number of frames of an acTL chunk when FRAMES is not 0.
+ */
+static std::string makePng(int width, int height, int bitDepth,
+		int colorType, int frames)
+{
+	std::string png("\x89PNG\r\n\x1A\n", 8);
+	png += be(13, 4) + "IHDR" + be(width, 4) + be(height, 4)
+		+ static_cast<char>(bitDepth) + static_cast<char>(colorType)
+		+ std::string(3, '\0') + be(0, 4);
+	/* An unrelated chunk before the interesting one. */
+	png += be(4, 4) + "gAMA" + be(45455, 4) + be(0, 4);
+	if (frames != 0)
+		png += be(8, 4) + "acTL" + be(frames, 4);
+	else
+		png += be(0, 4) + "IDAT";
+	return png;
+}
+
+static std::string makeWebp(const char* chunk, const std::string& payload)
+{
+	return "RIFF" + le(0, 4) + "WEBP" + chunk
+		+ le(static_cast<quint32>(payload.size()), 4) + payload;
+}
+
+static std::string makeWebpVp8(int width, int height)
+{
+	/* Frame tag + start code + 14 bits width and height with 2 bits scale. */
+	return makeWebp("VP8 ", le(0, 3) + "\x9D\x01\x2A"
+			+ le(width | 0x4000, 2) + le(height | 0x8000, 2));
+}
+
+static std::string makeWebpVp8l(int width, int height, bool alpha)
+{
+	return makeWebp("VP8L", "\x2F" + le((width - 1) | ((height - 1) << 14)
+				| (alpha ? 1u << 28 : 0), 4));
+}
+
+static std::string makeWebpVp8x(int width, int height, int flags)
+{
+	return makeWebp("VP8X", static_cast<char>(flags) + le(0, 3)
+			+ le(width - 1, 3) + le(height - 1, 3));
+}
+
+static bool readHeader(const std::string& data, ImageFormat format,
+		ImageHeader* header)
+{
+	return readImageHeader(data.data(), data.size(), format, header);
+}
+
+static bool readJpeg(const std::string& jpeg, ImageHeader* header)
+{
+	return readHeader(jpeg, ImageFormat::jpeg, header);
+}
+
+/**
+ * @brief Check that a header is parsed as WIDTH x HEIGHT x DEPTH, and that
+ *        every part of it shorter than the whole is rejected.
+ */
+static void checkHeader(const std::string& data, ImageFormat format,
+		int width, int height, int depth, bool animated, const char* what)
+{
+	ImageHeader header;
+	if (!readHeader(data, format, &header)) {
+		check(false, what);
+		return;
+	}
+	check(header.width == width && header.height == height
+			&& header.depth == depth && header.animated == animated, what);
+	for (size_t len = 0; len != data.size(); ++len) {
+		if (readHeader(data.substr(0, len), format, &header)) {
+			fprintf(stderr, "FAILED: %s is accepted with %zu bytes only\n",
+					what, len);
+			++failures;
+			return;
+		}
+	}
+}
+
+static void testJpegOrientation()
+{
+	for (bool le : { true, false }) {
+		for (int orientation = 0; orientation <= 8; ++orientation) {
+			ImageHeader header;
+			bool ok = readJpeg(makeJpeg(600, 300, orientation, le), &header);
+			check(ok, "jpeg header is parsed");
+			bool rotated = orientation >= 5;
+			check(header.width == (rotated ? 300 : 600)
+					&& header.height == (rotated ? 600 : 300),
+					"jpeg dimensions follow the EXIF orientation");
+			check(header.depth == 24, "jpeg depth");
+		}
+	}
+
+	/* Invalid orientations are ignored. */
+	ImageHeader header;
+	check(readJpeg(makeJpeg(600, 300, 9, true), &header)
+			&& header.width == 600 && header.height == 300,
+			"invalid orientation is ignored");
+
+	/* The SOF is missing when the data is cut in the EXIF segment. */
+	std::string jpeg = makeJpeg(600, 300, 6, true);
+	check(!readJpeg(jpeg.substr(0, 20), &header),
+			"truncated jpeg header is rejected");
+}
+
+static void testBmp()
+{
+	checkHeader(makeBmpInfo(100, 60, 24), ImageFormat::bmp, 100, 60, 24,
+			false, "bmp");
+	checkHeader(makeBmpInfo(100, -60, 32), ImageFormat::bmp, 100, 60, 32,
+			false, "top-down bmp");
+	checkHeader(makeBmpCore(64, 48, 8), ImageFormat::bmp, 64, 48, 8,
+			false, "bmp with BITMAPCOREHEADER");
+
+	ImageHeader header;
+	check(!readHeader(makeBmpInfo(0, 60, 24), ImageFormat::bmp, &header),
+			"bmp without width is rejected");
+	std::string bmp = makeBmpInfo(100, 60, 24);
+	bmp[14] = 20;
+	check(!readHeader(bmp, ImageFormat::bmp, &header),
+			"bmp with unknown DIB header is rejected");
+}
+
+static void testGif()
+{
+	checkHeader(makeGif(320, 240, 0xF7), ImageFormat::gif, 320, 240, 8,
+			false, "gif with a global color table of 256");
+	checkHeader(makeGif(320, 240, 0x81), ImageFormat::gif, 320, 240, 2,
+			false, "gif with a global color table of 4");
+	checkHeader(makeGif(16, 16, 0x00), ImageFormat::gif, 16, 16, 8,
+			false, "gif without a global color table");
+
+	ImageHeader header;
+	std::string gif = makeGif(320, 240, 0xF7);
+	gif[4] = '8';
+	check(!readHeader(gif, ImageFormat::gif, &header),
+			"gif with a bad signature is rejected");
+}
+
+static void testPng()
+{
+	checkHeader(makePng(640, 480, 8, 2, 0), ImageFormat::png, 640, 480, 24,
+			false, "truecolor png");
+	checkHeader(makePng(640, 480, 8, 6, 0), ImageFormat::png, 640, 480, 32,
+			false, "truecolor png with alpha");
+	checkHeader(makePng(640, 480, 16, 4, 0), ImageFormat::png, 640, 480, 32,
+			false, "16 bits grayscale png with alpha");
+	checkHeader(makePng(640, 480, 4, 3, 0), ImageFormat::png, 640, 480, 4,
+			false, "indexed-color png");
+	checkHeader(makePng(640, 480, 8, 6, 12), ImageFormat::png, 640, 480, 32,
+			true, "animated png");
+	checkHeader(makePng(640, 480, 8, 6, 1), ImageFormat::png, 640, 480, 32,
+			false, "png with an acTL chunk of 1 frame");
+
+	ImageHeader header;
+	check(!readHeader(makePng(640, 480, 8, 5, 0), ImageFormat::png, &header),
+			"png with an unknown color type is rejected");
+}
+
+static void testWebp()
+{
+	checkHeader(makeWebpVp8(800, 600), ImageFormat::webp, 800, 600, 24,
+			false, "lossy webp");
+	checkHeader(makeWebpVp8l(100, 122, false), ImageFormat::webp, 100, 122,
+			24, false, "lossless webp");
+	checkHeader(makeWebpVp8l(100, 122, true), ImageFormat::webp, 100, 122,
+			32, false, "lossless webp with alpha");
+	checkHeader(makeWebpVp8x(800, 480, 0x00), ImageFormat::webp, 800, 480,
+			24, false, "extended webp");
+	checkHeader(makeWebpVp8x(800, 480, 0x10), ImageFormat::webp, 800, 480,
+			32, false, "extended webp with alpha");
+	checkHeader(makeWebpVp8x(800, 480, 0x12), ImageFormat::webp, 800, 480,
+			32, true, "animated webp");
+	checkHeader(makeWebpVp8x(1 << 20, 3, 0x02), ImageFormat::webp, 1 << 20,
+			3, 24, true, "animated webp with 24 bits width");
+
+	ImageHeader header;
+	std::string webp = makeWebpVp8(800, 600);
+	webp[23] = '\0';
+	check(!readHeader(webp, ImageFormat::webp, &header),
+			"lossy webp with a bad start code is rejected");
+	check(!readHeader(makeWebp("VP8Z", std::string(10, '\0')),
+				ImageFormat::webp, &header),
+			"webp with an unknown chunk is rejected");
+}
+
+int main()
+{
+	testJpegOrientation();
+	testBmp();
+	testGif();
+	testPng();
+	testWebp();
+	if (failures == 0)
+		printf("All image header tests passed.\n");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+/**
+ * thumbnailer_test.cc
+ *
+ * Check that the thumbnails of rotated jpeg images keep the aspect ratio.
+ *
+ * Created by vamirio on 2022 Nov 27
+ */
+#include <cstdio>
+
+#include <QBuffer>
+#include <QColor>
+#include <QCoreApplication>
+#include <QImage>
+
+#include "thumbnailer.h"
+
+using namespace img_view;
+
+static int failures = 0;
+
+static void check(bool cond, const char* what)
+{
+	if (!cond) {
+		fprintf(stderr, "FAILED: %s\n", what);
+		++failures;
+	}
+}
+
+/**
+ * @brief Encode a WIDTH x HEIGHT jpeg image, red on the left half and blue on
+ *        the right, with the EXIF ORIENTATION when it is not 0.
+ */
+static QByteArray makeJpeg(int width, int height, int orientation)
+{
+	QImage image(width, height, QImage::Format_RGB888);
+	image.fill(Qt::blue);
+	for (int y = 0; y != height; ++y) {
+		for (int x = 0; x != width / 2; ++x)
+			image.setPixelColor(x, y, Qt::red);
+	}
+	QByteArray jpeg;
+	QBuffer buf(&jpeg);
+	buf.open(QIODevice::WriteOnly);
+	image.save(&buf, "JPG", 95);
+
+	if (orientation != 0) {
+		/* APP1 with a big endian TIFF header and IFD0 holding only the
+		 * orientation, right after SOI. */
+		const char app1[] = "\xFF\xE1\x00\x22" "Exif\0\0"
+			"MM\x00\x2A\x00\x00\x00\x08" "\x00\x01"
+			"\x01\x12\x00\x03\x00\x00\x00\x01\x00\x00\x00\x00"
+			"\x00\x00\x00\x00";
+		QByteArray exif(app1, sizeof(app1) - 1);
+		exif[4 + 6 + 8 + 2 + 9] = static_cast<char>(orientation);
+		jpeg.insert(2, exif);
+	}
+	return jpeg;
+}
+
+static QImage readThumbnail(QByteArray jpeg)
+{
+	QBuffer buf(&jpeg);
+	buf.open(QIODevice::ReadOnly);
+	return Thumbnailer::read(&buf);
+}
+
+static void testRotated()
+{
+	QImage thumbnail = readThumbnail(makeJpeg(800, 400, 6));
+	check(thumbnail.size() == QSize(128, 256),
+			"rotated thumbnail is scaled before the rotation");
+	/* Rotated clockwise, the left half ends up on the top. */
+	QColor top = thumbnail.pixelColor(64, 32);
+	QColor bottom = thumbnail.pixelColor(64, 224);
+	check(top.red() > top.blue() && bottom.blue() > bottom.red(),
+			"rotated thumbnail is rotated clockwise");
+
+	thumbnail = readThumbnail(makeJpeg(800, 400, 8));
+	check(thumbnail.size() == QSize(128, 256),
+			"thumbnail rotated counterclockwise keeps the aspect ratio");
+}
+
+static void testUnrotated()
+{
+	QImage thumbnail = readThumbnail(makeJpeg(800, 400, 0));
+	check(thumbnail.size() == QSize(256, 128), "thumbnail without EXIF");
+
+	thumbnail = readThumbnail(makeJpeg(800, 400, 1));
+	check(thumbnail.size() == QSize(256, 128),
+			"thumbnail with the normal orientation");
+}
+
+static void testSmall()
+{
+	/* Images fitting in the thumbnail are not enlarged, only rotated. */
+	QImage thumbnail = readThumbnail(makeJpeg(100, 50, 6));
+	check(thumbnail.size() == QSize(50, 100), "small rotated thumbnail");
+}
+
+int main(int argc, char** argv)
+{
+	/* The jpeg plugin is found through the application. */
+	QCoreApplication app(argc, argv);
+
+	testRotated();
+	testUnrotated();
+	testSmall();
+
+	if (failures == 0)
+		printf("All thumbnailer tests passed.\n");
+	return failures == 0 ? 0 : 1;
+}